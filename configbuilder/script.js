@@ -101,7 +101,8 @@ const calcVPB = (event) => {
         vpb /= count;
     }
 
-    $("#BAT_SENSE_VPB").val(vpb).change();
+    // The firmware uses integer microvolts per bit
+    $("#BAT_SENSE_UVPB").val(Math.round(vpb * 1000000)).change();
 }
 
 const getConfigLen = () => {
@@ -174,6 +175,14 @@ const makeConfig = ({
                             case "int":
                                 field.val(parseInt(hexSubStr, 16));
                                 break;
+                            case "sint":
+                                num = parseInt(hexSubStr, 16);
+                                // Two's complement
+                                if (num >= Math.pow(2, datatypeSize * 8 - 1)) {
+                                    num -= Math.pow(2, datatypeSize * 8);
+                                }
+                                field.val(num);
+                                break;
                             case "float":
                                 field.val(HexToFloat32(hexSubStr));
                                 break;
@@ -215,6 +224,24 @@ const makeConfig = ({
                                             errorMsg = "Invalid number";
                                         }
 
+                                        break;
+                                    case "sint":
+                                        num = parseInt(field.val());
+
+                                        if (!isNaN(num) && !field.val().match(/,/g)) {
+                                            let range = Math.pow(2, datatypeSize * 8 - 1);
+                                            if (num >= range) {
+                                                errorMsg = "Number to large";
+                                            } else if (num < -range) {
+                                                errorMsg = "Number too small";
+                                            } else {
+                                                // Two's complement
+                                                hexStr = padHexStr(((num + 2 * range) % (2 * range)).toString(16), datatypeSize * 2);
+                                            }
+                                        } else {
+                                            errorMsg = "Invalid number";
+                                        }
+
                                         break;
                                     case "float":
                                         num = parseFloat(field.val());
@@ -0,0 +1,50 @@
+// Debug log events, LOG_EVENT(id, text). Included several times with
+// different definitions of LOG_EVENT, so there is no include guard.
+//
+// Without LOG_TOKENS the firmware prints the text of an event with its
+// arguments. With LOG_TOKENS it only sends the index of the event and its
+// arguments, tools/log_decode.py turns them back into text with this table.
+// Append new events at the end, so logs of older builds still decode.
+//
+// Arguments: %u unsigned, %d signed, %x hex, %h bytes as hex (logBytes())
+
+LOG_EVENT(LOG_BOOT, "\n= Starting LoRaProMini v%u.%u =")
+LOG_EVENT(LOG_CONFIG_INVALID, "INVALID CONFIG!")
+LOG_EVENT(LOG_JOIN_ABP, "Join mode ABP")
+LOG_EVENT(LOG_JOIN_OTAA, "Join mode OTAA")
+LOG_EVENT(LOG_BACKLOG_PUSH, "Backlog: %u")
+LOG_EVENT(LOG_SENSOR_FAILED, "Sensor failed #%u")
+LOG_EVENT(LOG_DS_ALARM_FAILED, "DS18x alarm setup failed #%u")
+LOG_EVENT(LOG_PREPARE, "Prepare pck #%u")
+LOG_EVENT(LOG_PAYLOAD, "> Payload: %h")
+LOG_EVENT(LOG_QUEUED, "Pck queued")
+LOG_EVENT(LOG_EVENT_FRAME, "> Event: %h")
+LOG_EVENT(LOG_EVENT_QUEUED, "Event queued")
+LOG_EVENT(LOG_BACKLOG_FRAME, "> Backlog: %h")
+LOG_EVENT(LOG_BACKLOG_QUEUED, "Backlog queued")
+LOG_EVENT(LOG_DIAG_FRAME, "> Diag: %h")
+LOG_EVENT(LOG_DIAG_QUEUED, "Diag queued")
+LOG_EVENT(LOG_JOINING, "Joining...")
+LOG_EVENT(LOG_JOINED, "Joined!")
+LOG_EVENT(LOG_JOIN_FAILED, "Join failed")
+LOG_EVENT(LOG_REJOIN_FAILED, "Rejoin failed")
+LOG_EVENT(LOG_ISR_TO_TX, "ISR to TX start: %ums")
+LOG_EVENT(LOG_BOOT_TO_TX, "Boot to first TX: %ums")
+LOG_EVENT(LOG_TX_DONE, "TX done #%u")
+LOG_EVENT(LOG_ACK, "> Got ack")
+LOG_EVENT(LOG_NACK, "> Got NO ack")
+LOG_EVENT(LOG_NO_JOIN_ACCEPT, "NO JoinAccept")
+LOG_EVENT(LOG_TX_CANCELED, "TX canceled!")
+LOG_EVENT(LOG_UNKNOWN_EVENT, "Unknown Evt: %u")
+LOG_EVENT(LOG_WAKE_ITR, "Waked from ItrPin %u!")
+LOG_EVENT(LOG_DS_FOUND, "Search DS18x...%u found")
+LOG_EVENT(LOG_BME_FOUND, "Search BME...%u found")
+LOG_EVENT(LOG_CACHE_INVALID, "Sensor cache invalid")
+LOG_EVENT(LOG_CACHE_MISMATCH_DS, "Sensor cache mismatch (DS18x)")
+LOG_EVENT(LOG_CACHE_MISMATCH_BME, "Sensor cache mismatch (BME)")
+LOG_EVENT(LOG_CACHE_LOADED, "Sensors from cache: %u DS18x, %u BME")
+LOG_EVENT(LOG_BAT_LOW, "Bat to low!")
+LOG_EVENT(LOG_CANT_SLEEP, "> Can't sleep")
+LOG_EVENT(LOG_SLEEP, "Sleep %us\n")
+LOG_EVENT(LOG_SLEEP_FOREVER, "Sleep FOREVER\n")
+LOG_EVENT(LOG_CYCLE, "Cycle charge %uuC, total %umC")
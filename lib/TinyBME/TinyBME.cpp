@@ -8,7 +8,7 @@ TinyBME::TinyBME()
 }
 
 // initialise the bus
-bool TinyBME::begin(uint8_t addr)
+bool TinyBME::begin(uint8_t addr, const bme280_calib_data *calib)
 {
     _i2caddr = addr;
     _wire = &Wire;
@@ -19,26 +19,44 @@ bool TinyBME::begin(uint8_t addr)
         return false;
     }
 
-    // Reset the device using soft-reset
-    // This makes sure the IIR is off, etc.
-    write8(BME280_REGISTER_SOFTRESET, 0xB6);
+    if (calib)
+    {
+        // Trimming parameters known, the registers below are written anyway
+        _bme280_calib = *calib;
+    }
+    else
+    {
+        // Reset the device using soft-reset
+        // This makes sure the IIR is off, etc.
+        write8(BME280_REGISTER_SOFTRESET, 0xB6);
 
-    // Wait for chip to wake up.
-    delay(10);
+        // Wait for chip to wake up.
+        delay(10);
 
-    // Read trimming parameters, see DS 4.2.2
-    readCoefficients();
+        // Read trimming parameters, see DS 4.2.2
+        readCoefficients();
+    }
 
     write8(BME280_REGISTER_CONTROL, MODE_SLEEP);
     write8(BME280_REGISTER_CONTROLHUMID, SAMPLING_X1);                                        // DS 5.4.3 - Register 0xF2 “ctrl_hum” - Set before CONTROL!
     write8(BME280_REGISTER_CONFIG, ((STANDBY_MS_0_5 << 5) | (FILTER_OFF << 2)));              // DS 5.4.6 - Register 0xF5 “config” (7-5 standby time, 4-2 filter settings, 1-0 unused)
     write8(BME280_REGISTER_CONTROL, ((SAMPLING_X1 << 5) | (SAMPLING_X1 << 2) | MODE_FORCED)); // DS 5.4.5 - Register 0xF4 “ctrl_meas” (7-5 temperature oversampling, 4-2 pressure oversampling, 1-0 device mode)
 
-    delay(100);
+    // takeForcedMeasurement() waits for the conversion, no need to wait here
+    if (!calib)
+    {
+        delay(100);
+    }
 
     return true;
 }
 
+// Returns the factory-set coefficients read by begin()
+const bme280_calib_data &TinyBME::getCalibration(void)
+{
+    return _bme280_calib;
+}
+
 // Writes an 8 bit value
 void TinyBME::write8(byte reg, byte value)
 {
@@ -146,7 +164,7 @@ void TinyBME::readCoefficients(void)
 }
 
 // Take a new measurement (only possible in forced mode)
-bool TinyBME::takeForcedMeasurement(void)
+bool TinyBME::takeForcedMeasurement(uint16_t timeout)
 {
     bool return_value = false;
     // If we are in forced mode, the BME sensor goes back to sleep after each
@@ -161,11 +179,11 @@ bool TinyBME::takeForcedMeasurement(void)
     // Store current time to measure the timeout
     uint32_t timeout_start = millis();
     // wait until measurement has been completed, otherwise we would read the
-    // the values from the last measurement or the timeout occurred after 2 sec.
+    // the values from the last measurement or the timeout occurred.
     while (read8(BME280_REGISTER_STATUS) & 0x08)
     {
         // In case of a timeout, stop the while loop
-        if ((millis() - timeout_start) > 2000)
+        if ((millis() - timeout_start) > timeout)
         {
             return_value = false;
             break;
@@ -178,11 +196,35 @@ bool TinyBME::takeForcedMeasurement(void)
 
 // Returns the temperature from the sensor
 float TinyBME::readTemperature(void)
+{
+    int16_t T = readTemperature100();
+    if (T == BME280_TEMP_INVALID)
+        return NAN;
+    return T / 100.0;
+}
+
+//  Returns the pressure from the sensor
+float TinyBME::readPressure(void)
+{
+    return readPressurePa();
+}
+
+// Returns the humidity from the sensor
+float TinyBME::readHumidity(void)
+{
+    uint32_t h = readHumidityQ10();
+    if (h == UINT32_MAX)
+        return NAN;
+    return h / 1024.0;
+}
+
+// Returns the temperature in 1/100 degrees C, see DS 4.2.3
+int16_t TinyBME::readTemperature100(void)
 {
 
     int32_t adc_T = read24(BME280_REGISTER_TEMPDATA);
     if (adc_T == 0x800000) // value in case temp measurement was disabled
-        return NAN;
+        return BME280_TEMP_INVALID;
     adc_T >>= 4;
 
     int32_t var1 = ((((adc_T >> 3) - ((int32_t)_bme280_calib.dig_T1 << 1))) *
@@ -197,52 +239,68 @@ float TinyBME::readTemperature(void)
 
     t_fine = var1 + var2;
 
-    float T = (t_fine * 5 + 128) >> 8;
-    return T / 100;
+    return (t_fine * 5 + 128) >> 8;
 }
 
-//  Returns the pressure from the sensor
-float TinyBME::readPressure(void)
+// Returns the pressure in Pa, 32 bit integer version of DS 8.2
+uint32_t TinyBME::readPressurePa(void)
 {
-    int64_t var1, var2, p;
+    int32_t var1, var2;
+    uint32_t p;
 
-    readTemperature(); // must be done first to get t_fine
+    readTemperature100(); // must be done first to get t_fine
 
     int32_t adc_P = read24(BME280_REGISTER_PRESSUREDATA);
     if (adc_P == 0x800000) // value in case pressure measurement was disabled
-        return NAN;
+        return 0;
     adc_P >>= 4;
 
-    var1 = ((int64_t)t_fine) - 128000;
-    var2 = var1 * var1 * (int64_t)_bme280_calib.dig_P6;
-    var2 = var2 + ((var1 * (int64_t)_bme280_calib.dig_P5) << 17);
-    var2 = var2 + (((int64_t)_bme280_calib.dig_P4) << 35);
-    var1 = ((var1 * var1 * (int64_t)_bme280_calib.dig_P3) >> 8) +
-           ((var1 * (int64_t)_bme280_calib.dig_P2) << 12);
-    var1 =
-        (((((int64_t)1) << 47) + var1)) * ((int64_t)_bme280_calib.dig_P1) >> 33;
+    var1 = (t_fine >> 1) - (int32_t)64000;
+    var2 = (((var1 >> 2) * (var1 >> 2)) >> 11) * ((int32_t)_bme280_calib.dig_P6);
+    var2 = var2 + ((var1 * ((int32_t)_bme280_calib.dig_P5)) << 1);
+    var2 = (var2 >> 2) + (((int32_t)_bme280_calib.dig_P4) << 16);
+    var1 = (((_bme280_calib.dig_P3 * (((var1 >> 2) * (var1 >> 2)) >> 13)) >> 3) +
+            ((((int32_t)_bme280_calib.dig_P2) * var1) >> 1)) >>
+           18;
+    var1 = (((32768 + var1)) * ((int32_t)_bme280_calib.dig_P1)) >> 15;
 
     if (var1 == 0)
     {
         return 0; // avoid exception caused by division by zero
     }
-    p = 1048576 - adc_P;
-    p = (((p << 31) - var2) * 3125) / var1;
-    var1 = (((int64_t)_bme280_calib.dig_P9) * (p >> 13) * (p >> 13)) >> 25;
-    var2 = (((int64_t)_bme280_calib.dig_P8) * p) >> 19;
+    p = (((uint32_t)(((int32_t)1048576) - adc_P) - (var2 >> 12))) * 3125;
+    if (p < 0x80000000)
+    {
+        p = (p << 1) / ((uint32_t)var1);
+    }
+    else
+    {
+        p = (p / (uint32_t)var1) * 2;
+    }
+    var1 = (((int32_t)_bme280_calib.dig_P9) * ((int32_t)(((p >> 3) * (p >> 3)) >> 13))) >> 12;
+    var2 = (((int32_t)(p >> 2)) * ((int32_t)_bme280_calib.dig_P8)) >> 13;
+    p = (uint32_t)((int32_t)p + ((var1 + var2 + _bme280_calib.dig_P7) >> 4));
 
-    p = ((p + var1 + var2) >> 8) + (((int64_t)_bme280_calib.dig_P7) << 4);
-    return (float)p / 256;
+    return p;
 }
 
-// Returns the humidity from the sensor
-float TinyBME::readHumidity(void)
+// Returns the humidity in 1/100 %RH
+uint16_t TinyBME::readHumidity100(void)
+{
+    uint32_t h = readHumidityQ10();
+    if (h == UINT32_MAX)
+        return UINT16_MAX;
+    return (h * 100 + 512) >> 10;
+}
+
+// Returns the humidity in 1/1024 %RH, see DS 4.2.3
+uint32_t TinyBME::readHumidityQ10(void)
 {
-    readTemperature(); // must be done first to get t_fine
+    readTemperature100(); // must be done first to get t_fine
 
     int32_t adc_H = read16(BME280_REGISTER_HUMIDDATA);
     if (adc_H == 0x8000) // value in case humidity measurement was disabled
-        return NAN;
+        return UINT32_MAX;
 
     int32_t v_x1_u32r;
 
@@ -267,6 +325,5 @@ float TinyBME::readHumidity(void)
 
     v_x1_u32r = (v_x1_u32r < 0) ? 0 : v_x1_u32r;
     v_x1_u32r = (v_x1_u32r > 419430400) ? 419430400 : v_x1_u32r;
-    float h = (v_x1_u32r >> 12);
-    return h / 1024.0;
-}
\ No newline at end of file
+    return (v_x1_u32r >> 12);
+}
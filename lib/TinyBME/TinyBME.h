@@ -113,6 +113,9 @@ typedef struct
     int8_t dig_H6;
 } bme280_calib_data;
 
+// Returned by readTemperature100() if the temperature measurement was disabled
+#define BME280_TEMP_INVALID INT16_MIN
+
 //Temperature units
 enum BME280_temp_t
 {
@@ -125,11 +128,16 @@ class TinyBME
 public:
     TinyBME();
 
-    // Initialise bus
-    bool begin(uint8_t addr = BME280_ADDRESS);
+    // Initialise bus. With calibration data from a previous begin() the
+    // soft reset and the coefficient readout are skipped.
+    bool begin(uint8_t addr = BME280_ADDRESS, const bme280_calib_data *calib = NULL);
+
+    // Returns the factory-set coefficients read by begin()
+    const bme280_calib_data &getCalibration(void);
 
     // Take a new measurement (only possible in forced mode)
-    bool takeForcedMeasurement(void);
+    // returns false if the measurement did not complete within timeout ms
+    bool takeForcedMeasurement(uint16_t timeout = 2000);
 
     //  Returns the temperature from the sensor
     float readTemperature(void);
@@ -140,6 +148,15 @@ public:
     //  Returns the humidity from the sensor
     float readHumidity(void);
 
+    // Returns the temperature in 1/100 degrees C, without floating point
+    int16_t readTemperature100(void);
+
+    // Returns the pressure in Pa, without floating point
+    uint32_t readPressurePa(void);
+
+    // Returns the humidity in 1/100 %RH, without floating point
+    uint16_t readHumidity100(void);
+
 private:
     // Pointer to a TwoWire object
     TwoWire *_wire;
@@ -168,6 +185,9 @@ private:
     // Reads the factory-set coefficients
     void readCoefficients(void);
 
+    // Returns the humidity in 1/1024 %RH
+    uint32_t readHumidityQ10(void);
+
     // I2C addr for the TwoWire interface
     uint8_t _i2caddr;
 
@@ -30,14 +30,26 @@
 TinyDallas::TinyDallas(OneWire *_oneWire)
 {
     _wire = _oneWire;
+    addresses = NULL;
+    stored = 0;
 }
 
 // initialise the bus
 void TinyDallas::begin(void)
+{
+    begin(NULL, 0);
+}
+
+// initialise the bus with a single search, the addresses of the
+// first size devices are stored in the table
+void TinyDallas::begin(DeviceAddress *table, uint8_t size)
 {
 
     DeviceAddress deviceAddress;
 
+    addresses = table;
+    stored = 0;
+
     _wire->reset_search();
     devices = 0; // Reset the number of devices when we enumerate wire devices
 
@@ -45,6 +57,10 @@ void TinyDallas::begin(void)
     {
         if (validAddress(deviceAddress) && validFamily(deviceAddress))
         {
+            if (stored < size)
+            {
+                memcpy(addresses[stored++], deviceAddress, sizeof(DeviceAddress));
+            }
             devices++;
         }
     }
@@ -80,6 +96,13 @@ bool TinyDallas::validFamily(const uint8_t *deviceAddress)
 bool TinyDallas::getAddress(uint8_t *deviceAddress, uint8_t index)
 {
 
+    // Lookup in the table of begin(), no bus search needed
+    if (index < stored)
+    {
+        memcpy(deviceAddress, addresses[index], sizeof(DeviceAddress));
+        return true;
+    }
+
     uint8_t depth = 0;
 
     _wire->reset_search();
@@ -108,6 +131,17 @@ float TinyDallas::getTempC(const uint8_t *deviceAddress)
     return (float)raw / 16.0;
 }
 
+// returns temperature in 1/100 degrees C or DEVICE_DISCONNECTED_C100 if the
+// device's scratch pad cannot be read successfully.
+int16_t TinyDallas::getTemp100(const uint8_t *deviceAddress)
+{
+    int16_t raw = getTemp(deviceAddress);
+    if (raw <= DEVICE_DISCONNECTED_RAW)
+        return DEVICE_DISCONNECTED_C100;
+    // C = RAW/16, truncated like getTempC() * 100
+    return (int32_t)raw * 100 / 16;
+}
+
 // returns temperature in degrees F or DEVICE_DISCONNECTED_F if the
 // device's scratch pad cannot be read successfully.
 // the numeric value of DEVICE_DISCONNECTED_F is defined in
@@ -123,14 +157,19 @@ float TinyDallas::getTempF(const uint8_t *deviceAddress)
 }
 
 // sends command for all devices on the bus to perform a temperature conversion
-void TinyDallas::requestTemperatures()
+// returns false without waiting for the conversion if no device answered the
+// reset with a presence pulse (no device or bus short)
+bool TinyDallas::requestTemperatures()
 {
 
-    _wire->reset();
+    if (_wire->reset() == 0)
+        return false;
     _wire->skip();
     _wire->write(STARTCONVO);
 
     delay(750); // maybe 750ms is enough, maybe not
+
+    return true;
 }
 
 // // reads scratchpad and returns fixed-point temperature, scaling factor 2^-7
@@ -200,6 +239,48 @@ bool TinyDallas::readScratchPad(const uint8_t *deviceAddress,
     return (b == 1);
 }
 
+// sets the high and low alarm temperature. The values are written to the
+// scratchpad only, copying them to the EEPROM of the device would wear it
+// on every boot. returns true if the device answered.
+bool TinyDallas::setAlarms(const uint8_t *deviceAddress, int8_t high, int8_t low)
+{
+    ScratchPad scratchPad;
+    if (!readScratchPad(deviceAddress, scratchPad))
+        return false;
+
+    _wire->reset();
+    _wire->select(deviceAddress);
+    _wire->write(WRITESCRATCH);
+    _wire->write((uint8_t)high);
+    _wire->write((uint8_t)low);
+
+    // DS1820 and DS18S20 have no configuration register
+    if (deviceAddress[DSROM_FAMILY] != DS18S20MODEL)
+        _wire->write(scratchPad[CONFIGURATION]);
+
+    return (_wire->reset() == 1);
+}
+
+// restarts the alarm search
+void TinyDallas::resetAlarmSearch(void)
+{
+    _wire->reset_search();
+}
+
+// finds the next device with an active alarm using the conditional
+// search (0xEC). Only devices with a temperature at or above the high or at
+// or below the low alarm value of the last conversion take part in the search.
+bool TinyDallas::alarmSearch(uint8_t *deviceAddress)
+{
+    while (_wire->search(deviceAddress, false))
+    {
+        if (validAddress(deviceAddress) && validFamily(deviceAddress))
+            return true;
+    }
+
+    return false;
+}
+
 // returns temperature in 1/128 degrees C or DEVICE_DISCONNECTED_RAW if the
 // device's scratch pad cannot be read successfully.
 // the numeric value of DEVICE_DISCONNECTED_RAW is defined in
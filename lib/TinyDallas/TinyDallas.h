@@ -7,6 +7,7 @@
 #define DEVICE_DISCONNECTED_C -127
 #define DEVICE_DISCONNECTED_F -196.6
 #define DEVICE_DISCONNECTED_RAW -7040
+#define DEVICE_DISCONNECTED_C100 -12700
 
 typedef uint8_t DeviceAddress[8];
 
@@ -18,6 +19,10 @@ public:
     // initialise bus
     void begin();
 
+    // initialise bus and store the addresses of up to size devices in
+    // the table. getAddress() reads from the table instead of the bus.
+    void begin(DeviceAddress *table, uint8_t size);
+
     // returns the number of devices found on the bus
     uint8_t getDeviceCount();
 
@@ -39,8 +44,12 @@ public:
     // returns temperature in degrees F
     float getTempF(const uint8_t *);
 
+    // returns temperature in 1/100 degrees C, without floating point
+    int16_t getTemp100(const uint8_t *);
+
     // sends command for all devices on the bus to perform a temperature conversion
-    void requestTemperatures(void);
+    // returns false if no device answered the reset
+    bool requestTemperatures(void);
 
     // returns temperature raw value (12 bit integer of 1/128 degrees C)
     int16_t getTemp(const uint8_t *);
@@ -48,6 +57,16 @@ public:
     // read device's scratchpad
     bool readScratchPad(const uint8_t *, uint8_t *);
 
+    // sets the high and low alarm temperature in degrees C (scratchpad only)
+    bool setAlarms(const uint8_t *, int8_t, int8_t);
+
+    // restarts the alarm search
+    void resetAlarmSearch(void);
+
+    // finds the next device with an active alarm after the last conversion
+    // returns false if there are no more devices in alarm
+    bool alarmSearch(uint8_t *);
+
     // convert from raw to Celsius
     static float rawToCelsius(int16_t);
 
@@ -61,6 +80,12 @@ private:
     // count of DS18xxx Family devices on bus
     uint8_t devices;
 
+    // addresses found by begin(), provided by the caller
+    DeviceAddress *addresses;
+
+    // number of addresses stored in the table
+    uint8_t stored;
+
     // Returns true if all bytes of scratchPad are '\0'
     bool isAllZeros(const uint8_t *const scratchPad, const size_t length = 9);
 
@@ -0,0 +1,506 @@
+// Arduino core and libraries of the native simulation
+#include <stdio.h>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LowPower.h>
+#include <OneWire.h>
+#include <Wire.h>
+#include <avr/sleep.h>
+#include "sim.h"
+
+// Time of a byte on the I2C bus at 100 kHz (8 bits + ACK) and of a start/stop condition
+#define I2C_BYTE_US 90
+#define I2C_START_STOP_US 20
+// 1-Wire reset with presence detect and one time slot (standard speed)
+#define ONEWIRE_RESET_US 960
+#define ONEWIRE_SLOT_US 65
+// One ADC conversion at 125 kHz ADC clock
+#define ADC_CONVERSION_US 104
+// Self-timed EEPROM write of one byte
+#define EEPROM_WRITE_US 3400
+// Watchdog oscillator runs slow, see do_sleep() in main.cpp
+#define WDT_SLOW_PERCENT 12
+
+volatile uint8_t PRR, ADCSRA, WDTCSR;
+volatile uint8_t MCUSR = bit(PORF); // Every run starts with a power-on reset
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t PINB, PINC, PIND;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+TwoWire Wire;
+LowPowerClass LowPower;
+
+static uint8_t pinOut[22];
+static void (*intFunc[2])(void);
+static int intMode[2];
+static uint64_t wdtEndUs;
+
+// Defined by main.cpp with ISR()
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// PINS AND INTERRUPTS
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (pin < sizeof(pinOut))
+  {
+    pinOut[pin] = val;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin <= 7)
+  {
+    return bitRead(PIND, pin);
+  }
+  return pin < sizeof(pinOut) ? pinOut[pin] : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  simRun(ADC_CONVERSION_US);
+  return simAdc;
+}
+
+void analogReference(uint8_t mode)
+{
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode)
+{
+  if (interruptNum < 2)
+  {
+    intFunc[interruptNum] = userFunc;
+    intMode[interruptNum] = mode;
+  }
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+  if (interruptNum < 2)
+  {
+    intFunc[interruptNum] = NULL;
+  }
+}
+
+bool simPinEdge(uint8_t pin, uint8_t level)
+{
+  bool served = false;
+
+  if (bitRead(PIND, pin) == level)
+  {
+    return false;
+  }
+  PIND = level ? (PIND | bit(pin)) : (PIND & ~bit(pin));
+
+  int8_t num = digitalPinToInterrupt(pin);
+  if (num >= 0 && intFunc[num] &&
+      (intMode[num] == CHANGE || (intMode[num] == RISING) == (level == HIGH)))
+  {
+    intFunc[num]();
+    served = true;
+  }
+
+  if ((PCICR & bit(digitalPinToPCICRbit(pin))) && (PCMSK2 & bit(pin)) && PCINT2_vect)
+  {
+    PCINT2_vect();
+    served = true;
+  }
+
+  return served;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// TIME
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+unsigned long millis()
+{
+  return (unsigned long)(simAwakeUs / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)simAwakeUs;
+}
+
+void delay(unsigned long ms)
+{
+  simRun(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  simRun(us);
+}
+
+long random(long howbig)
+{
+  return howbig == 0 ? 0 : ::random() % howbig;
+}
+
+long random(long howsmall, long howbig)
+{
+  return howsmall >= howbig ? howsmall : random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+  if (seed != 0)
+  {
+    srandom(seed);
+  }
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// SLEEP
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+// LowPower enables the watchdog with WDIE set, its interrupt clears WDIE again
+void LowPowerClass::powerDown(period_t period, adc_t adc, bod_t bod)
+{
+  static const uint16_t periodMs[] = {15, 30, 60, 120, 250, 500, 1000, 2000, 4000, 8000};
+
+  if (period != SLEEP_FOREVER)
+  {
+    wdtEndUs = simRealUs + periodMs[period] * (1000ULL + WDT_SLOW_PERCENT * 10);
+    WDTCSR |= bit(WDIE);
+  }
+  simSleepCpu();
+}
+
+void simSleepCpu()
+{
+  if (!(WDTCSR & bit(WDIE)))
+  {
+    simPowerDown(UINT64_MAX);
+  }
+  else if (!simPowerDown(wdtEndUs))
+  {
+    WDTCSR &= ~bit(WDIE);
+  }
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// SERIAL
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC)
+  {
+    return print('-') + print((unsigned long)-n, base);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  *str = '\0';
+  if (base < 2)
+  {
+    base = 10;
+  }
+  do
+  {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+
+  return write(str);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+static unsigned long serialCharUs = 10000000UL / 9600;
+static char rxLine[256];
+static size_t rxLen = 0;
+static size_t rxPos = 0;
+static bool rxWait = true;
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  // Start bit, 8 data bits and stop bit
+  serialCharUs = 10000000UL / baud;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (!simQuiet && c != '\r')
+  {
+    putchar(c);
+    if (c == '\n')
+    {
+      fflush(stdout);
+    }
+  }
+  simRun(serialCharUs);
+  return 1;
+}
+
+// Every line of stdin arrives as one chunk, an empty receive buffer is
+// seen once before the next line arrives
+int HardwareSerial::available()
+{
+  if (rxPos < rxLen)
+  {
+    return rxLen - rxPos;
+  }
+  if (!rxWait)
+  {
+    rxWait = true;
+    return 0;
+  }
+  if (!fgets(rxLine, sizeof(rxLine), stdin))
+  {
+    simFinish("end of serial input");
+  }
+  rxLen = strcspn(rxLine, "\r\n");
+  rxPos = 0;
+  rxWait = false;
+  return rxLen;
+}
+
+int HardwareSerial::peek()
+{
+  return available() > 0 ? rxLine[rxPos] : -1;
+}
+
+int HardwareSerial::read()
+{
+  return available() > 0 ? rxLine[rxPos++] : -1;
+}
+
+size_t HardwareSerial::readBytes(char *buffer, size_t length)
+{
+  size_t n = 0;
+  while (n < length && rxPos < rxLen)
+  {
+    buffer[n++] = rxLine[rxPos++];
+  }
+  return n;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// EEPROM
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+void EEPROMClass::write(int idx, uint8_t val)
+{
+  data[idx] = val;
+  simRun(EEPROM_WRITE_US);
+}
+
+void EEPROMClass::update(int idx, uint8_t val)
+{
+  if (data[idx] != val)
+  {
+    write(idx, val);
+  }
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// I2C
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+// Bus time of a transfer, counted for the report
+static void busTransfer(simBus_t &bus, uint8_t bytes, uint32_t us)
+{
+  bus.bytes += bytes;
+  bus.us += us;
+  simRun(us);
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  _address = address;
+  _txLen = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if (_txLen >= BUFFER_LENGTH)
+  {
+    return 0;
+  }
+  _txBuffer[_txLen++] = data;
+  return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+  simI2c.transactions++;
+  busTransfer(simI2c, 1 + _txLen, I2C_START_STOP_US + (1 + _txLen) * I2C_BYTE_US);
+  return simI2cWrite(_address, _txBuffer, _txLen);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+  quantity = min(quantity, BUFFER_LENGTH);
+  simI2c.transactions++;
+  busTransfer(simI2c, 1 + quantity, I2C_START_STOP_US + (1 + quantity) * I2C_BYTE_US);
+  _rxLen = simI2cRead(address, _rxBuffer, quantity);
+  _rxPos = 0;
+  return _rxLen;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// 1-WIRE
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+uint8_t OneWire::reset()
+{
+  simOneWire.transactions++;
+  busTransfer(simOneWire, 0, ONEWIRE_RESET_US);
+  return simOneWireReset();
+}
+
+void OneWire::write_bit(uint8_t v)
+{
+  busTransfer(simOneWire, 0, ONEWIRE_SLOT_US);
+}
+
+uint8_t OneWire::read_bit()
+{
+  busTransfer(simOneWire, 0, ONEWIRE_SLOT_US);
+  return 1;
+}
+
+void OneWire::write(uint8_t v, uint8_t power)
+{
+  busTransfer(simOneWire, 1, 8 * ONEWIRE_SLOT_US);
+  simOneWireWrite(v);
+}
+
+void OneWire::write_bytes(const uint8_t *buf, uint16_t count, bool power)
+{
+  for (uint16_t i = 0; i < count; i++)
+  {
+    write(buf[i]);
+  }
+}
+
+uint8_t OneWire::read()
+{
+  busTransfer(simOneWire, 1, 8 * ONEWIRE_SLOT_US);
+  return simOneWireRead();
+}
+
+void OneWire::read_bytes(uint8_t *buf, uint16_t count)
+{
+  for (uint16_t i = 0; i < count; i++)
+  {
+    buf[i] = read();
+  }
+}
+
+void OneWire::select(const uint8_t rom[8])
+{
+  write(0x55);
+  write_bytes(rom, 8);
+}
+
+void OneWire::skip()
+{
+  write(0xCC);
+}
+
+// The search is not done bit by bit, LastDiscrepancy counts the devices found
+void OneWire::reset_search()
+{
+  LastDiscrepancy = 0;
+  LastDeviceFlag = false;
+  LastFamilyDiscrepancy = 0;
+  memset(ROM_NO, 0, sizeof(ROM_NO));
+}
+
+void OneWire::target_search(uint8_t family_code)
+{
+  reset_search();
+  ROM_NO[0] = family_code;
+}
+
+bool OneWire::search(uint8_t *newAddr, bool search_mode)
+{
+  if (LastDeviceFlag || !reset())
+  {
+    reset_search();
+    return false;
+  }
+
+  // Search command, then 64 times two read slots and one write slot
+  write(search_mode ? 0xF0 : 0xEC);
+  busTransfer(simOneWire, 8, 64 * 3 * ONEWIRE_SLOT_US);
+
+  if (!simOneWireSearch(LastDiscrepancy, !search_mode, ROM_NO))
+  {
+    reset_search();
+    return false;
+  }
+
+  LastDiscrepancy++;
+  memcpy(newAddr, ROM_NO, sizeof(ROM_NO));
+  return true;
+}
+
+// Dallas CRC-8, polynomial x^8 + x^5 + x^4 + 1
+uint8_t OneWire::crc8(const uint8_t *addr, uint8_t len)
+{
+  uint8_t crc = 0;
+
+  while (len--)
+  {
+    uint8_t inbyte = *addr++;
+    for (uint8_t i = 8; i; i--)
+    {
+      uint8_t mix = (crc ^ inbyte) & 0x01;
+      crc >>= 1;
+      if (mix)
+      {
+        crc ^= 0x8C;
+      }
+      inbyte >>= 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,579 @@
+// Devices on the buses of the native simulation: a BME280 on I2C and
+// DS18B20/DS18S20 probes on 1-Wire. The drivers talk to them through the
+// Wire and OneWire mocks, which count the traffic and the bus time.
+#include <Arduino.h>
+#include "sim.h"
+
+#define BME_ADDRESS 0x76
+#define BME_CHIP_ID 0x60
+#define BME_REG_CALIB_TP 0x88
+#define BME_REG_CALIB_H1 0xA1
+#define BME_REG_CHIPID 0xD0
+#define BME_REG_RESET 0xE0
+#define BME_REG_CALIB_H2 0xE1
+#define BME_REG_CTRL_HUM 0xF2
+#define BME_REG_STATUS 0xF3
+#define BME_REG_CTRL_MEAS 0xF4
+#define BME_REG_DATA 0xF7
+#define BME_STATUS_MEASURING 0x08
+
+// Factory calibration of a BME280 (T1-T3, P1-P9 and H1-H6)
+static const uint16_t bmeCalibT[] = {28485, 26735, 50};
+static const int16_t bmeCalibP[] = {(int16_t)37503, -10493, 3024, 8121, -88, -7, 9900, -10230, 4285};
+static const uint8_t bmeCalibH1 = 75;
+static const int16_t bmeCalibH2 = 352;
+static const uint8_t bmeCalibH3 = 0;
+static const int16_t bmeCalibH4 = 338;
+static const int16_t bmeCalibH5 = 50;
+static const int8_t bmeCalibH6 = 30;
+
+// Conditions seen by the BME280
+#define BME_TEMP 21.50
+#define BME_HUMIDITY 45.00
+#define BME_PRESSURE 101325.0
+
+#define DS_MAX 8
+#define DS18S20_FAMILY 0x10
+#define DS18B20_FAMILY 0x28
+
+enum _OneWireState
+{
+  OW_IDLE,
+  OW_ROM_COMMAND,
+  OW_MATCH_ROM,
+  OW_FUNCTION,
+  OW_READ_SCRATCH,
+  OW_WRITE_SCRATCH
+};
+
+typedef struct
+{
+  uint8_t rom[8];
+  int16_t temp100;    // Temperature of the probe
+  uint8_t scratch[9]; // Without valid CRC, see dsScratchCrc()
+  uint64_t convEndUs; // End of a pending conversion
+  bool converting;
+  bool disconnected; // Off the bus, see simDsConnect()
+} dsDevice_t;
+
+bool simBmePresent = true;
+uint32_t simBmeMeasureUs = 0;
+simBus_t simI2c;
+simBus_t simOneWire;
+
+static uint8_t bmeRegs[256];
+static uint8_t bmePointer;
+static uint64_t bmeMeasEndUs;
+static bool bmeMeasuring;
+
+static dsDevice_t ds[DS_MAX];
+static uint8_t dsNum = 0;
+static uint8_t owState = OW_IDLE;
+static int8_t owSelected; // Index of the matched device, -1 = all (skip ROM)
+static uint8_t owCount;
+static uint8_t owRom[8];
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// BME280
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+// Compensation formulas in double precision, see DS 8.1
+static double bmeTemp(int32_t adcT, double &tFine)
+{
+  double var1 = (adcT / 16384.0 - bmeCalibT[0] / 1024.0) * (int16_t)bmeCalibT[1];
+  double var2 = (adcT / 131072.0 - bmeCalibT[0] / 8192.0);
+  var2 = var2 * var2 * (int16_t)bmeCalibT[2];
+  tFine = var1 + var2;
+  return tFine / 5120.0;
+}
+
+static double bmePressure(int32_t adcP, double tFine)
+{
+  double var1 = tFine / 2.0 - 64000.0;
+  double var2 = var1 * var1 * bmeCalibP[5] / 32768.0;
+  var2 = var2 + var1 * bmeCalibP[4] * 2.0;
+  var2 = var2 / 4.0 + bmeCalibP[3] * 65536.0;
+  var1 = (bmeCalibP[2] * var1 * var1 / 524288.0 + bmeCalibP[1] * var1) / 524288.0;
+  var1 = (1.0 + var1 / 32768.0) * (uint16_t)bmeCalibP[0];
+  double p = 1048576.0 - adcP;
+  p = (p - var2 / 4096.0) * 6250.0 / var1;
+  var1 = bmeCalibP[8] * p * p / 2147483648.0;
+  var2 = p * bmeCalibP[7] / 32768.0;
+  return p + (var1 + var2 + bmeCalibP[6]) / 16.0;
+}
+
+static double bmeHumidity(int32_t adcH, double tFine)
+{
+  double h = tFine - 76800.0;
+  h = (adcH - (bmeCalibH4 * 64.0 + bmeCalibH5 / 16384.0 * h)) *
+      (bmeCalibH2 / 65536.0 * (1.0 + bmeCalibH6 / 67108864.0 * h * (1.0 + bmeCalibH3 / 67108864.0 * h)));
+  return h * (1.0 - bmeCalibH1 * h / 524288.0);
+}
+
+// Raw reading of a value, found by bisection (temperature and humidity rise with
+// the raw value, the pressure falls)
+static int32_t bmeRaw(uint8_t value, double target, double tFine, int32_t hi)
+{
+  int32_t lo = 0;
+
+  while (lo < hi)
+  {
+    int32_t mid = (lo + hi) / 2;
+    double t;
+    double v = value == 0 ? bmeTemp(mid, t) : (value == 1 ? -bmePressure(mid, tFine) : bmeHumidity(mid, tFine));
+    if (v < (value == 1 ? -target : target))
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void bmeSetData()
+{
+  double tFine;
+  int32_t adcT = bmeRaw(0, BME_TEMP, 0, 0xFFFFF);
+  bmeTemp(adcT, tFine);
+  int32_t adcP = bmeRaw(1, BME_PRESSURE, tFine, 0xFFFFF);
+  int32_t adcH = bmeRaw(2, BME_HUMIDITY, tFine, 0xFFFF);
+
+  bmeRegs[BME_REG_DATA] = adcP >> 12;
+  bmeRegs[BME_REG_DATA + 1] = adcP >> 4;
+  bmeRegs[BME_REG_DATA + 2] = adcP << 4;
+  bmeRegs[BME_REG_DATA + 3] = adcT >> 12;
+  bmeRegs[BME_REG_DATA + 4] = adcT >> 4;
+  bmeRegs[BME_REG_DATA + 5] = adcT << 4;
+  bmeRegs[BME_REG_DATA + 6] = adcH >> 8;
+  bmeRegs[BME_REG_DATA + 7] = adcH;
+}
+
+static void bmeReset()
+{
+  memset(bmeRegs, 0, sizeof(bmeRegs));
+  bmeRegs[BME_REG_CHIPID] = BME_CHIP_ID;
+
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    bmeRegs[BME_REG_CALIB_TP + i * 2] = bmeCalibT[i];
+    bmeRegs[BME_REG_CALIB_TP + i * 2 + 1] = bmeCalibT[i] >> 8;
+  }
+  for (uint8_t i = 0; i < 9; i++)
+  {
+    bmeRegs[BME_REG_CALIB_TP + 6 + i * 2] = bmeCalibP[i];
+    bmeRegs[BME_REG_CALIB_TP + 6 + i * 2 + 1] = bmeCalibP[i] >> 8;
+  }
+  bmeRegs[BME_REG_CALIB_H1] = bmeCalibH1;
+  bmeRegs[BME_REG_CALIB_H2] = (uint8_t)bmeCalibH2;
+  bmeRegs[BME_REG_CALIB_H2 + 1] = bmeCalibH2 >> 8;
+  bmeRegs[BME_REG_CALIB_H2 + 2] = bmeCalibH3;
+  bmeRegs[BME_REG_CALIB_H2 + 3] = bmeCalibH4 >> 4;
+  bmeRegs[BME_REG_CALIB_H2 + 4] = (uint8_t)((bmeCalibH4 & 0x0F) | (bmeCalibH5 << 4));
+  bmeRegs[BME_REG_CALIB_H2 + 5] = bmeCalibH5 >> 4;
+  bmeRegs[BME_REG_CALIB_H2 + 6] = bmeCalibH6;
+
+  // Reset values of the data registers, as after a skipped measurement
+  bmeRegs[BME_REG_DATA] = 0x80;
+  bmeRegs[BME_REG_DATA + 3] = 0x80;
+  bmeRegs[BME_REG_DATA + 6] = 0x80;
+  bmeMeasuring = false;
+}
+
+// Typical measurement time, see DS 9.1
+static uint32_t bmeMeasureUs()
+{
+  uint8_t osrsT = (bmeRegs[BME_REG_CTRL_MEAS] >> 5) & 0x07;
+  uint8_t osrsP = (bmeRegs[BME_REG_CTRL_MEAS] >> 2) & 0x07;
+  uint8_t osrsH = bmeRegs[BME_REG_CTRL_HUM] & 0x07;
+  uint32_t us = 1000;
+
+  if (simBmeMeasureUs > 0)
+  {
+    return simBmeMeasureUs;
+  }
+  if (osrsT)
+  {
+    us += 2000 << (min(osrsT, 5) - 1);
+  }
+  if (osrsP)
+  {
+    us += (2000 << (min(osrsP, 5) - 1)) + 500;
+  }
+  if (osrsH)
+  {
+    us += (2000 << (min(osrsH, 5) - 1)) + 500;
+  }
+  return us;
+}
+
+// Finish a measurement that is due, forced mode returns to sleep mode afterwards
+static void bmeUpdate()
+{
+  if (bmeRegs[BME_REG_CHIPID] != BME_CHIP_ID)
+  {
+    // Power up
+    bmeReset();
+  }
+  if (bmeMeasuring && simRealUs >= bmeMeasEndUs)
+  {
+    bmeSetData();
+    bmeRegs[BME_REG_STATUS] &= ~BME_STATUS_MEASURING;
+    bmeRegs[BME_REG_CTRL_MEAS] &= ~0x03;
+    bmeMeasuring = false;
+  }
+}
+
+static void bmeWrite(uint8_t reg, uint8_t value)
+{
+  if (reg == BME_REG_RESET)
+  {
+    if (value == 0xB6)
+    {
+      bmeReset();
+    }
+    return;
+  }
+  if (reg == BME_REG_CTRL_HUM || reg == BME_REG_CTRL_MEAS || reg == 0xF5)
+  {
+    bmeRegs[reg] = value;
+  }
+  if (reg == BME_REG_CTRL_MEAS && (value & 0x03) && !bmeMeasuring)
+  {
+    bmeMeasuring = true;
+    bmeMeasEndUs = simRealUs + bmeMeasureUs();
+    bmeRegs[BME_REG_STATUS] |= BME_STATUS_MEASURING;
+  }
+}
+
+// The first byte sets the register pointer, then register/value pairs follow
+uint8_t simI2cWrite(uint8_t address, const uint8_t *data, uint8_t len)
+{
+  if (!simBmePresent || address != BME_ADDRESS)
+  {
+    return 2;
+  }
+
+  bmeUpdate();
+  if (len > 0)
+  {
+    bmePointer = data[0];
+  }
+  for (uint8_t i = 0; i + 1 < len; i += 2)
+  {
+    bmeWrite(data[i], data[i + 1]);
+  }
+  return 0;
+}
+
+// Reads auto-increment the register pointer
+uint8_t simI2cRead(uint8_t address, uint8_t *data, uint8_t len)
+{
+  if (!simBmePresent || address != BME_ADDRESS)
+  {
+    return 0;
+  }
+
+  bmeUpdate();
+  for (uint8_t i = 0; i < len; i++)
+  {
+    data[i] = bmeRegs[bmePointer++];
+  }
+  return len;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// DS18x
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+static uint8_t crc8(const uint8_t *data, uint8_t len)
+{
+  uint8_t crc = 0;
+
+  while (len--)
+  {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      crc = crc & 0x01 ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+static void dsSetTemp(dsDevice_t &dev, int16_t temp100)
+{
+  // Temperature in 1/16 °C
+  int16_t t16 = ((int32_t)temp100 * 16 + (temp100 < 0 ? -50 : 50)) / 100;
+
+  if (dev.rom[0] == DS18S20_FAMILY)
+  {
+    // 0.5 °C register, COUNT_REMAIN gives the 1/16 °C:
+    // T = TEMP_READ - 0.25 + (16 - COUNT_REMAIN) / 16, TEMP_READ = register / 2
+    int16_t tempRead = (t16 + 4) >> 4;
+    int16_t reg = tempRead * 2 + (t16 - tempRead * 16 >= 8 ? 1 : 0);
+    dev.scratch[0] = reg;
+    dev.scratch[1] = reg >> 8;
+    dev.scratch[6] = tempRead * 16 + 12 - t16;
+  }
+  else
+  {
+    // The low bits are undefined below 12 bit resolution
+    int16_t reg = t16;
+    uint8_t undefined = (1 << (3 - ((dev.scratch[4] >> 5) & 0x03))) - 1;
+    reg &= ~undefined;
+    dev.scratch[0] = reg;
+    dev.scratch[1] = reg >> 8;
+  }
+}
+
+// Temperature in whole °C as compared with the alarm values
+static int8_t dsAlarmTemp(const dsDevice_t &dev)
+{
+  int16_t reg = dev.scratch[0] | (dev.scratch[1] << 8);
+  return dev.rom[0] == DS18S20_FAMILY ? reg >> 1 : reg >> 4;
+}
+
+static bool dsInAlarm(const dsDevice_t &dev)
+{
+  int8_t t = dsAlarmTemp(dev);
+  return t >= (int8_t)dev.scratch[2] || t <= (int8_t)dev.scratch[3];
+}
+
+static void dsUpdate()
+{
+  for (uint8_t i = 0; i < dsNum; i++)
+  {
+    if (ds[i].converting && simRealUs >= ds[i].convEndUs)
+    {
+      dsSetTemp(ds[i], ds[i].temp100);
+      ds[i].converting = false;
+    }
+  }
+}
+
+// Conversion time of 750 ms at 12 bit, halved for each bit less
+static uint32_t dsConversionUs(const dsDevice_t &dev)
+{
+  if (dev.rom[0] == DS18S20_FAMILY)
+  {
+    return 750000;
+  }
+  return 93750UL << ((dev.scratch[4] >> 5) & 0x03);
+}
+
+bool simAddDs(bool s20, int16_t temp100)
+{
+  if (dsNum >= DS_MAX)
+  {
+    return false;
+  }
+
+  dsDevice_t &dev = ds[dsNum];
+  memset(&dev, 0, sizeof(dev));
+  dev.rom[0] = s20 ? DS18S20_FAMILY : DS18B20_FAMILY;
+  dev.rom[1] = 0x10 + dsNum;
+  dev.rom[2] = 0xA5;
+  dev.rom[3] = 0x5A;
+  dev.rom[4] = dsNum;
+  dev.rom[7] = crc8(dev.rom, 7);
+  dev.temp100 = temp100;
+
+  // Power-on values, 85 °C in the temperature register
+  dev.scratch[2] = 75;
+  dev.scratch[3] = 70;
+  if (s20)
+  {
+    dev.scratch[0] = 0xAA;
+    dev.scratch[4] = 0xFF;
+    dev.scratch[5] = 0xFF;
+    dev.scratch[6] = 0x0C;
+    dev.scratch[7] = 0x10;
+  }
+  else
+  {
+    dev.scratch[0] = 0x50;
+    dev.scratch[1] = 0x05;
+    dev.scratch[4] = 0x7F;
+    dev.scratch[5] = 0xFF;
+    dev.scratch[7] = 0x10;
+  }
+
+  dsNum++;
+  return true;
+}
+
+void simDsConnect(uint8_t n, bool connected)
+{
+  if (n < dsNum)
+  {
+    ds[n].disconnected = !connected;
+  }
+}
+
+static bool dsOnBus()
+{
+  for (uint8_t i = 0; i < dsNum; i++)
+  {
+    if (!ds[i].disconnected)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool simOneWireReset()
+{
+  dsUpdate();
+  owState = dsOnBus() ? OW_ROM_COMMAND : OW_IDLE;
+  return dsOnBus();
+}
+
+void simOneWireWrite(uint8_t value)
+{
+  dsUpdate();
+
+  switch (owState)
+  {
+  case OW_ROM_COMMAND:
+    if (value == 0x55) // Match ROM
+    {
+      owState = OW_MATCH_ROM;
+      owCount = 0;
+    }
+    else if (value == 0xCC) // Skip ROM
+    {
+      owState = OW_FUNCTION;
+      owSelected = -1;
+    }
+    else // Search ROM and alarm search are done by simOneWireSearch()
+    {
+      owState = OW_IDLE;
+    }
+    break;
+
+  case OW_MATCH_ROM:
+    owRom[owCount++] = value;
+    if (owCount == 8)
+    {
+      owState = OW_IDLE;
+      for (uint8_t i = 0; i < dsNum; i++)
+      {
+        if (!ds[i].disconnected && memcmp(ds[i].rom, owRom, 8) == 0)
+        {
+          owState = OW_FUNCTION;
+          owSelected = i;
+        }
+      }
+    }
+    break;
+
+  case OW_FUNCTION:
+    if (value == 0x44) // Convert T
+    {
+      for (uint8_t i = 0; i < dsNum; i++)
+      {
+        if ((owSelected < 0 || owSelected == i) && !ds[i].disconnected)
+        {
+          ds[i].converting = true;
+          ds[i].convEndUs = simRealUs + dsConversionUs(ds[i]);
+        }
+      }
+      owState = OW_IDLE;
+    }
+    else if (value == 0xBE && owSelected >= 0) // Read scratchpad
+    {
+      owState = OW_READ_SCRATCH;
+      owCount = 0;
+    }
+    else if (value == 0x4E) // Write scratchpad
+    {
+      owState = OW_WRITE_SCRATCH;
+      owCount = 0;
+    }
+    else
+    {
+      owState = OW_IDLE;
+    }
+    break;
+
+  case OW_WRITE_SCRATCH:
+    for (uint8_t i = 0; i < dsNum; i++)
+    {
+      uint8_t len = ds[i].rom[0] == DS18S20_FAMILY ? 2 : 3;
+      if ((owSelected < 0 || owSelected == i) && !ds[i].disconnected && owCount < len)
+      {
+        ds[i].scratch[2 + owCount] = owCount == 2 ? (value & 0x60) | 0x1F : value;
+      }
+    }
+    owCount++;
+    break;
+
+  default:
+    break;
+  }
+}
+
+uint8_t simOneWireRead()
+{
+  if (owState != OW_READ_SCRATCH || owCount >= 9)
+  {
+    return 0xFF;
+  }
+
+  dsDevice_t &dev = ds[owSelected];
+  dev.scratch[8] = crc8(dev.scratch, 8);
+  return dev.scratch[owCount++];
+}
+
+// The search finds the ROMs in the order of their bits, starting with bit 0 of byte 0
+static bool dsSearchBefore(const uint8_t *a, const uint8_t *b)
+{
+  for (uint8_t i = 0; i < 64; i++)
+  {
+    uint8_t bitA = (a[i / 8] >> (i % 8)) & 1;
+    uint8_t bitB = (b[i / 8] >> (i % 8)) & 1;
+    if (bitA != bitB)
+    {
+      return bitA < bitB;
+    }
+  }
+  return false;
+}
+
+bool simOneWireSearch(uint8_t n, bool alarmOnly, uint8_t *rom)
+{
+  const uint8_t *found[DS_MAX];
+  uint8_t count = 0;
+
+  dsUpdate();
+  for (uint8_t i = 0; i < dsNum; i++)
+  {
+    if (ds[i].disconnected || (alarmOnly && !dsInAlarm(ds[i])))
+    {
+      continue;
+    }
+    uint8_t j = count++;
+    while (j > 0 && dsSearchBefore(ds[i].rom, found[j - 1]))
+    {
+      found[j] = found[j - 1];
+      j--;
+    }
+    found[j] = ds[i].rom;
+  }
+  owState = OW_IDLE;
+
+  if (n >= count)
+  {
+    return false;
+  }
+  memcpy(rom, found[n], 8);
+  return true;
+}
@@ -0,0 +1,44 @@
+// CRC32 of the native simulation, same checksum as bakercp/CRC32 (and the configbuilder)
+#pragma once
+
+#include <Arduino.h>
+
+class CRC32
+{
+public:
+  CRC32() { reset(); }
+
+  void reset() { _state = 0xFFFFFFFFUL; }
+
+  void update(const uint8_t &data)
+  {
+    _state ^= data;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      _state = (_state >> 1) ^ (_state & 1 ? 0xEDB88320UL : 0);
+    }
+  }
+
+  template <typename Type>
+  void update(const Type *data, size_t size)
+  {
+    const uint8_t *ptr = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+      update(ptr[i]);
+    }
+  }
+
+  uint32_t finalize() const { return ~_state; }
+
+  template <typename Type>
+  static uint32_t calculate(const Type *data, size_t size)
+  {
+    CRC32 crc;
+    crc.update(data, size);
+    return crc.finalize();
+  }
+
+private:
+  uint32_t _state;
+};
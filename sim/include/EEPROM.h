@@ -0,0 +1,39 @@
+// EEPROM of the native simulation, 1 KB in RAM, loaded from and saved to an image file by sim.cpp
+#pragma once
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+public:
+  uint8_t data[E2END + 1];
+
+  uint8_t read(int idx) { return data[idx]; }
+  void write(int idx, uint8_t val);
+  void update(int idx, uint8_t val);
+  uint16_t length() { return E2END + 1; }
+
+  template <typename T>
+  T &getp(int idx, T *t)
+  {
+    memcpy(t, &data[idx], sizeof(T));
+    return *t;
+  }
+
+  template <typename T>
+  const T &put(int idx, const T &t)
+  {
+    const uint8_t *ptr = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+      update(idx + i, ptr[i]);
+    }
+    return t;
+  }
+};
+
+// The native build packs all structs like the AVR (-fpack-struct), a packed
+// member can't be bound to the reference of get(), so take its address instead
+#define get(idx, t) getp(idx, &(t))
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,33 @@
+// OneWire of the native simulation, the bus signals go to the devices on the simulated bus
+#pragma once
+
+#include <Arduino.h>
+
+class OneWire
+{
+public:
+  OneWire(uint8_t pin) {}
+
+  uint8_t reset();
+  void write_bit(uint8_t v);
+  uint8_t read_bit();
+  void write(uint8_t v, uint8_t power = 0);
+  void write_bytes(const uint8_t *buf, uint16_t count, bool power = 0);
+  uint8_t read();
+  void read_bytes(uint8_t *buf, uint16_t count);
+  void select(const uint8_t rom[8]);
+  void skip();
+  void depower() {}
+
+  void reset_search();
+  void target_search(uint8_t family_code);
+  bool search(uint8_t *newAddr, bool search_mode = true);
+
+  static uint8_t crc8(const uint8_t *addr, uint8_t len);
+
+private:
+  unsigned char ROM_NO[8];
+  uint8_t LastDiscrepancy;
+  uint8_t LastFamilyDiscrepancy;
+  bool LastDeviceFlag;
+};
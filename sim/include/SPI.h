@@ -0,0 +1,4 @@
+// SPI of the native simulation, the radio is modelled in lmic.cpp
+#pragma once
+
+#include <Arduino.h>
@@ -0,0 +1,35 @@
+// Wire of the native simulation, the transfers go to the devices on the simulated bus
+#pragma once
+
+#include <Arduino.h>
+
+#define WIRE_HAS_TIMEOUT
+#define BUFFER_LENGTH 32
+
+class TwoWire
+{
+public:
+  void begin() {}
+  void end() {}
+  void setClock(uint32_t clock) {}
+  void setWireTimeout(uint32_t timeout = 25000, bool reset_with_timeout = false) {}
+  bool getWireTimeoutFlag() { return false; }
+  void clearWireTimeoutFlag() {}
+
+  void beginTransmission(uint8_t address);
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity);
+  size_t write(uint8_t data);
+  int available() { return _rxLen - _rxPos; }
+  int read() { return _rxPos < _rxLen ? _rxBuffer[_rxPos++] : -1; }
+
+private:
+  uint8_t _address;
+  uint8_t _txBuffer[BUFFER_LENGTH];
+  uint8_t _txLen;
+  uint8_t _rxBuffer[BUFFER_LENGTH];
+  uint8_t _rxLen;
+  uint8_t _rxPos;
+};
+
+extern TwoWire Wire;
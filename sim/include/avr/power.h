@@ -0,0 +1,4 @@
+// Power reduction of the native simulation, main.cpp writes PRR directly
+#pragma once
+
+#include <Arduino.h>
@@ -0,0 +1,13 @@
+// Sleep modes of the native simulation, sleep_cpu() powers down until the watchdog or a pin edge
+#pragma once
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+void simSleepCpu();
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_bod_disable()
+#define sleep_cpu() simSleepCpu()
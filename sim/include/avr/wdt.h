@@ -0,0 +1,4 @@
+// Watchdog of the native simulation, only the reset flags are cleared at boot
+#pragma once
+
+#define wdt_disable()
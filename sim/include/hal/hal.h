@@ -0,0 +1,14 @@
+// LMIC pin map of the native simulation
+#pragma once
+
+#include <lmic.h>
+
+#define LMIC_UNUSED_PIN ((u1_t)-1)
+
+struct lmic_pinmap
+{
+  u1_t nss;
+  u1_t rxtx;
+  u1_t rst;
+  u1_t dio[3];
+};
@@ -0,0 +1,153 @@
+// LMIC of the native simulation, see lmic.cpp for the modelled MAC and radio timing
+#pragma once
+
+#include <Arduino.h>
+
+typedef uint8_t u1_t;
+typedef int8_t s1_t;
+typedef uint16_t u2_t;
+typedef int16_t s2_t;
+typedef uint32_t u4_t;
+typedef int32_t s4_t;
+typedef u1_t bit_t;
+typedef u1_t dr_t;
+typedef u4_t devaddr_t;
+typedef s4_t ostime_t;
+typedef u1_t *xref2u1_t;
+typedef int lmic_tx_error_t;
+
+#define OSTICKS_PER_SEC 62500
+#define us2osticks(us) ((ostime_t)(((int64_t)(us) * OSTICKS_PER_SEC) / 1000000))
+#define ms2osticks(ms) ((ostime_t)(((int64_t)(ms) * OSTICKS_PER_SEC) / 1000))
+#define sec2osticks(sec) ((ostime_t)((int64_t)(sec) * OSTICKS_PER_SEC))
+#define osticks2us(os) ((s4_t)(((int64_t)(os) * 1000000) / OSTICKS_PER_SEC))
+#define osticks2ms(os) ((s4_t)(((int64_t)(os) * 1000) / OSTICKS_PER_SEC))
+
+struct osjob_t;
+typedef void (*osjobcb_t)(osjob_t *);
+struct osjob_t
+{
+  osjob_t *next;
+  ostime_t deadline;
+  osjobcb_t func;
+};
+
+void os_init();
+void os_runloop_once();
+ostime_t os_getTime();
+void os_setCallback(osjob_t *job, osjobcb_t cb);
+void os_setTimedCallback(osjob_t *job, ostime_t time, osjobcb_t cb);
+void os_clearCallback(osjob_t *job);
+
+typedef enum
+{
+  EV_SCAN_TIMEOUT = 1,
+  EV_BEACON_FOUND,
+  EV_BEACON_MISSED,
+  EV_BEACON_TRACKED,
+  EV_JOINING,
+  EV_JOINED,
+  EV_RFU1,
+  EV_JOIN_FAILED,
+  EV_REJOIN_FAILED,
+  EV_TXCOMPLETE,
+  EV_LOST_TSYNC,
+  EV_RESET,
+  EV_RXCOMPLETE,
+  EV_LINK_DEAD,
+  EV_LINK_ALIVE,
+  EV_SCAN_FOUND,
+  EV_TXSTART,
+  EV_TXCANCELED,
+  EV_RXSTART,
+  EV_JOIN_TXCOMPLETE
+} ev_t;
+
+void onEvent(ev_t ev);
+
+enum
+{
+  OP_JOINING = 0x0004,
+  OP_TXDATA = 0x0008,
+  OP_TXRXPEND = 0x0080
+};
+
+enum
+{
+  TXRX_ACK = 0x80,
+  TXRX_NACK = 0x40,
+  TXRX_PORT = 0x10
+};
+
+enum
+{
+  TXCONF_ATTEMPTS = 8,
+  RSSI_OFF = 64
+};
+
+enum
+{
+  BAND_MILLI = 0,
+  BAND_CENTI = 1,
+  BAND_DECI = 2,
+  BAND_AUX = 3,
+  MAX_BANDS = 4
+};
+
+// EU868 data rates
+enum
+{
+  DR_SF12,
+  DR_SF11,
+  DR_SF10,
+  DR_SF9,
+  DR_SF8,
+  DR_SF7,
+  DR_SF7B,
+  DR_FSK
+};
+
+#define DR_RANGE_MAP(drlo, drhi) ((u2_t)((1 << ((drhi) + 1)) - (1 << (drlo))))
+#define MAX_CLOCK_ERROR 65536
+#define MAX_LEN_PAYLOAD 222
+#define LMIC_ERROR_SUCCESS 0
+#define LMIC_ERROR_TX_BUSY -1
+#define LMIC_ERROR_TX_TOO_LARGE -2
+
+typedef struct
+{
+  ostime_t avail;
+} band_t;
+
+struct lmic_t
+{
+  u2_t opmode;
+  u1_t txrxFlags;
+  u1_t dataBeg;
+  u1_t dataLen;
+  u1_t frame[MAX_LEN_PAYLOAD + 16];
+  u4_t seqnoUp;
+  dr_t datarate;
+  dr_t dn2Dr;
+  s1_t rssi;
+  s1_t snr;
+  u1_t txCnt;
+  u1_t pendTxConf;
+  ostime_t txend;
+  band_t bands[MAX_BANDS];
+  devaddr_t devaddr;
+};
+
+extern lmic_t LMIC;
+
+void LMIC_reset();
+void LMIC_setSession(u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
+bit_t LMIC_setupChannel(u1_t channel, u4_t freq, u2_t drmap, s1_t band);
+void LMIC_selectSubBand(u1_t band);
+void LMIC_setLinkCheckMode(bit_t enabled);
+void LMIC_setAdrMode(bit_t enabled);
+void LMIC_setDrTxpow(dr_t dr, s1_t txpow);
+void LMIC_setClockError(u2_t error);
+bit_t LMIC_startJoining();
+void LMIC_getSessionKeys(u4_t *netid, devaddr_t *devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
+lmic_tx_error_t LMIC_setTxData2(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed);
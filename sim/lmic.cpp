@@ -0,0 +1,339 @@
+// LMIC of the native simulation. Models the timing of the MAC as seen by main.cpp:
+// TX airtime, the RX windows, the retransmissions of confirmed uplinks, the frame
+// counter and the join. The frame is built when the TX starts, not when it is queued.
+// Duty cycle limits, ADR and MAC commands are not modelled.
+#include <stdio.h>
+#include <lmic.h>
+#include "sim.h"
+
+// Delay of the RX windows after the end of the TX
+#define RX1_DELAY_S 1
+#define RX2_DELAY_S 2
+#define JOIN_ACCEPT_DELAY1_S 5
+// An RX window without downlink closes after the preamble timeout of 8 symbols
+#define RX_TIMEOUT_SYMBOLS 8
+// Retransmission of a confirmed uplink without ACK, join retry without JoinAccept
+#define RETRY_DELAY_S 3
+#define JOIN_RETRY_DELAY_S 60
+// MHDR, FHDR and MIC of a frame, FPort of an uplink
+#define FRAME_OVERHEAD 12
+// Join request and join accept frames
+#define JOIN_REQUEST_LEN 23
+#define JOIN_ACCEPT_LEN 33
+// Link quality of the ACK
+#define ACK_RSSI -80
+#define ACK_SNR 8
+
+lmic_t LMIC;
+
+static osjob_t *jobs = NULL;
+static osjob_t radioJob;
+static bool joined = false;
+static uint8_t txPort;
+static uint8_t txLen;
+static uint8_t txData[MAX_LEN_PAYLOAD];
+static uint32_t txAirtimeUs;
+static uint32_t txFcnt;
+static uint8_t txAttempts;
+
+static uint8_t spreadingFactor(dr_t dr)
+{
+  return dr == DR_SF7B ? 7 : 12 - dr;
+}
+
+// Symbol time of a LoRa data rate, 250 kHz for DR_SF7B, 125 kHz otherwise
+static uint32_t symbolUs(dr_t dr)
+{
+  return (1000UL << spreadingFactor(dr)) / (dr == DR_SF7B ? 250 : 125);
+}
+
+// Time on air of a frame (CR 4/5, 8 symbols preamble, explicit header, CRC)
+static uint32_t airtimeUs(dr_t dr, uint8_t len)
+{
+  if (dr == DR_FSK)
+  {
+    // 50 kbps, 5 bytes preamble, 3 bytes sync word, length byte and CRC
+    return (len + 11) * 8 * 20;
+  }
+
+  uint8_t sf = spreadingFactor(dr);
+  uint8_t lowDataRate = (sf >= 11 && dr != DR_SF7B) ? 1 : 0;
+  int32_t bits = 8 * len - 4 * sf + 28 + 16;
+  int32_t div = 4 * (sf - 2 * lowDataRate);
+  int32_t symbols = 8 + (bits > 0 ? (bits + div - 1) / div * 5 : 0);
+
+  return symbolUs(dr) * 49 / 4 + symbols * symbolUs(dr);
+}
+
+static uint32_t rxTimeoutUs(dr_t dr)
+{
+  return dr == DR_FSK ? 1000 : RX_TIMEOUT_SYMBOLS * symbolUs(dr);
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// SCHEDULER
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+void os_init()
+{
+  jobs = NULL;
+}
+
+ostime_t os_getTime()
+{
+  return us2osticks(simAwakeUs);
+}
+
+void os_clearCallback(osjob_t *job)
+{
+  for (osjob_t **pnext = &jobs; *pnext; pnext = &(*pnext)->next)
+  {
+    if (*pnext == job)
+    {
+      *pnext = job->next;
+      return;
+    }
+  }
+}
+
+void os_setTimedCallback(osjob_t *job, ostime_t time, osjobcb_t cb)
+{
+  osjob_t **pnext;
+
+  os_clearCallback(job);
+  job->deadline = time;
+  job->func = cb;
+  for (pnext = &jobs; *pnext; pnext = &(*pnext)->next)
+  {
+    if ((*pnext)->deadline - time > 0)
+    {
+      break;
+    }
+  }
+  job->next = *pnext;
+  *pnext = job;
+}
+
+void os_setCallback(osjob_t *job, osjobcb_t cb)
+{
+  os_setTimedCallback(job, os_getTime(), cb);
+}
+
+// Runs the next job. While nothing is due, the MCU spins in loop() until it is.
+void os_runloop_once()
+{
+  if (!jobs)
+  {
+    simRun(100);
+    return;
+  }
+
+  osjob_t *job = jobs;
+  ostime_t wait = job->deadline - os_getTime();
+  if (wait > 0)
+  {
+    simRun(osticks2us(wait));
+  }
+
+  jobs = job->next;
+  job->func(job);
+}
+
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// MAC
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+static void txStart(osjob_t *job);
+
+static void txDone(osjob_t *job)
+{
+  uint8_t flags = 0;
+
+  if (LMIC.pendTxConf)
+  {
+    if (simNoNetwork)
+    {
+      if (LMIC.txCnt < TXCONF_ATTEMPTS)
+      {
+        LMIC.txCnt++;
+        os_setTimedCallback(&radioJob, os_getTime() + sec2osticks(RETRY_DELAY_S), txStart);
+        return;
+      }
+      flags = TXRX_NACK;
+    }
+    else
+    {
+      flags = TXRX_ACK;
+      LMIC.rssi = ACK_RSSI + RSSI_OFF;
+      LMIC.snr = ACK_SNR * 4;
+    }
+  }
+
+  LMIC.opmode &= ~(OP_TXDATA | OP_TXRXPEND);
+  LMIC.txrxFlags = flags | TXRX_PORT;
+  LMIC.dataBeg = 0;
+  LMIC.dataLen = 0;
+  onEvent(EV_TXCOMPLETE);
+  simUplink(txPort, txFcnt, txAttempts, txData, txLen, flags, txAirtimeUs);
+}
+
+static void txStart(osjob_t *job)
+{
+  uint32_t airtime = airtimeUs(LMIC.datarate, FRAME_OVERHEAD + 1 + txLen);
+  uint32_t rxUs;
+
+  // Build the frame. As in the MCCI LMIC the frame counter only counts up with
+  // txCnt 0, retransmissions (and a txCnt set before the frame is built) keep it.
+  if (LMIC.txCnt == 0)
+  {
+    LMIC.seqnoUp++;
+  }
+  txFcnt = LMIC.seqnoUp - 1;
+  txAttempts++;
+  txAirtimeUs += airtime;
+  onEvent(EV_TXSTART);
+  LMIC.txend = os_getTime() + us2osticks(airtime);
+
+  if (LMIC.pendTxConf && !simNoNetwork)
+  {
+    // ACK in RX1
+    rxUs = RX1_DELAY_S * 1000000UL + airtimeUs(LMIC.datarate, FRAME_OVERHEAD);
+  }
+  else
+  {
+    // No downlink in RX1 and RX2
+    rxUs = RX2_DELAY_S * 1000000UL + rxTimeoutUs(LMIC.dn2Dr);
+  }
+  os_setTimedCallback(&radioJob, LMIC.txend + us2osticks(rxUs), txDone);
+}
+
+static void joinTx(osjob_t *job);
+
+static void joinDone(osjob_t *job)
+{
+  if (simNoNetwork)
+  {
+    onEvent(EV_JOIN_TXCOMPLETE);
+    os_setTimedCallback(&radioJob, os_getTime() + sec2osticks(JOIN_RETRY_DELAY_S), joinTx);
+    return;
+  }
+
+  joined = true;
+  LMIC.opmode &= ~OP_JOINING;
+  onEvent(EV_JOINED);
+}
+
+static void joinTx(osjob_t *job)
+{
+  uint32_t airtime = airtimeUs(LMIC.datarate, JOIN_REQUEST_LEN);
+  uint32_t rxUs;
+
+  onEvent(EV_TXSTART);
+  LMIC.txend = os_getTime() + us2osticks(airtime);
+  if (simNoNetwork)
+  {
+    rxUs = (JOIN_ACCEPT_DELAY1_S + 1) * 1000000UL + rxTimeoutUs(LMIC.dn2Dr);
+  }
+  else
+  {
+    rxUs = JOIN_ACCEPT_DELAY1_S * 1000000UL + airtimeUs(LMIC.datarate, JOIN_ACCEPT_LEN);
+  }
+  os_setTimedCallback(&radioJob, LMIC.txend + us2osticks(rxUs), joinDone);
+}
+
+void LMIC_reset()
+{
+  os_clearCallback(&radioJob);
+  memset(&LMIC, 0, sizeof(LMIC));
+  LMIC.datarate = DR_SF7;
+  LMIC.dn2Dr = DR_SF12;
+  joined = false;
+}
+
+void LMIC_setSession(u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey)
+{
+  LMIC.devaddr = devaddr;
+  joined = true;
+}
+
+bit_t LMIC_setupChannel(u1_t channel, u4_t freq, u2_t drmap, s1_t band)
+{
+  return 1;
+}
+
+void LMIC_selectSubBand(u1_t band)
+{
+}
+
+void LMIC_setLinkCheckMode(bit_t enabled)
+{
+}
+
+void LMIC_setAdrMode(bit_t enabled)
+{
+}
+
+void LMIC_setDrTxpow(dr_t dr, s1_t txpow)
+{
+  LMIC.datarate = dr;
+}
+
+void LMIC_setClockError(u2_t error)
+{
+}
+
+bit_t LMIC_startJoining()
+{
+  if (joined || (LMIC.opmode & OP_JOINING))
+  {
+    return 0;
+  }
+
+  LMIC.opmode |= OP_JOINING;
+  onEvent(EV_JOINING);
+  os_setCallback(&radioJob, joinTx);
+  return 1;
+}
+
+void LMIC_getSessionKeys(u4_t *netid, devaddr_t *devaddr, xref2u1_t nwkKey, xref2u1_t artKey)
+{
+  *netid = 0x13;
+  *devaddr = LMIC.devaddr;
+  memset(nwkKey, 0, 16);
+  memset(artKey, 0, 16);
+}
+
+uint8_t simTxFrame(uint8_t *port, const uint8_t **data)
+{
+  *port = txPort;
+  *data = txData;
+  return txLen;
+}
+
+lmic_tx_error_t LMIC_setTxData2(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed)
+{
+  if (dlen > MAX_LEN_PAYLOAD)
+  {
+    return LMIC_ERROR_TX_TOO_LARGE;
+  }
+  if (LMIC.opmode & OP_TXRXPEND)
+  {
+    return LMIC_ERROR_TX_BUSY;
+  }
+
+  txPort = port;
+  LMIC.pendTxConf = confirmed;
+  txLen = dlen;
+  txAirtimeUs = 0;
+  txAttempts = 0;
+  memcpy(txData, data, dlen);
+
+  LMIC.txCnt = 0;
+  LMIC.opmode |= OP_TXDATA | OP_TXRXPEND;
+  os_setCallback(&radioJob, txStart);
+  return LMIC_ERROR_SUCCESS;
+}
@@ -0,0 +1,441 @@
+// Native simulation of the node: runs setup() and loop() of main.cpp on a simulated
+// clock and reports the awake time per power phase of every uplink.
+// Build and run with: pio run -e native && .pio/build/native/program -h
+#include <stdio.h>
+#include <unistd.h>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <lmic.h>
+#include "sim.h"
+
+#define MAX_EDGES 64
+#define MAX_PORTS 5
+#define PHASE_COUNT 6
+
+// High time of a pulse on an interrupt pin, low time of a pulse on a pulse counter pin
+#define ITR_PULSE_US 100000ULL
+#define COUNTER_PULSE_US 10000ULL
+
+// Defined in main.cpp
+void setup();
+void loop();
+extern uint8_t powerPhaseNow;
+
+// Names of _PowerPhase in main.cpp, the time before the first phase switch is "boot"
+static const char *phaseNames[PHASE_COUNT + 1] = {"sleep", "awake", "adc", "twi", "onewire", "encode", "boot"};
+
+// Default config (configData_t in main.cpp) if there is no EEPROM image: ABP,
+// 300 s sleep, all sensors, interrupt pins enabled
+static const uint8_t defaultConfig[] = {
+    2,                      // CONFIG_IS_VALID
+    0x2C, 0x01,             // SLEEPTIME
+    0xCC, 0x10, 0x00, 0x00, // BAT_SENSE_UVPB
+    0xF0, 0x0A, 0x00, 0x00, // BAT_MIN_MV
+    1,                      // WAKEUP_BY_INTERRUPT_PINS
+    0,                      // CONFIRMED_DATA_UP
+    2,                      // ACTIVATION_METHOD
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, // NWKSKEY
+    0x0F, 0x0E, 0x0D, 0x0C, 0x0B, 0x0A, 0x09, 0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00, // APPSKEY
+    0x78, 0x56, 0x34, 0x12,                         // DEVADDR
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // APPEUI
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // DEVEUI
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, // APPKEY
+    0,          // CONFIRM_EVERY_N
+    0,          // CONFIRM_RETRIES
+    0,          // TX_SLOTTED
+    0,          // EVENT_FAST_PATH
+    0,          // EVENT_COALESCE
+    0,          // PULSE_COUNTERS
+    7,          // SENSORS_PERIODIC
+    7,          // SENSORS_ITR0
+    7,          // SENSORS_ITR1
+    0,          // BAT_INTERVAL
+    0,          // BACKLOG
+    0x00, 0x00, // STATS_INTERVAL
+    0,          // DS_ALARM
+    0,          // DS_ALARM_HIGH
+    0,          // DS_ALARM_LOW
+    0x00, 0x00, // ALARM_SLEEPTIME
+    0,          // DIAG_INTERVAL
+};
+
+typedef struct
+{
+  uint64_t us;
+  uint8_t pin;
+  uint8_t level;
+} edge_t;
+
+uint64_t simRealUs = 0;
+uint64_t simAwakeUs = 0;
+bool simQuiet = false;
+bool simNoNetwork = false;
+uint16_t simAdc = 700;
+void (*simOnUplink)(uint8_t port, uint32_t fcnt, uint8_t attempts, const uint8_t *data, uint8_t len,
+                    uint8_t txrxFlags) = NULL;
+
+static uint64_t limitUs = 0;
+static uint16_t maxUplinks = 0; // Set by main(), no limit in the unit tests
+static const char *eepromFile = NULL;
+
+static edge_t edges[MAX_EDGES];
+static uint8_t edgeCount = 0;
+static uint8_t edgeNext = 0;
+
+static uint64_t phaseUs[PHASE_COUNT + 1];
+static uint64_t powerDownUs = 0;
+static uint64_t airtimeUs = 0;
+static uint16_t uplinks = 0;
+static uint16_t portUplinks[MAX_PORTS];
+
+// Snapshot at the previous uplink
+static uint64_t lastAwakeUs = 0;
+static uint64_t lastPhaseUs[PHASE_COUNT + 1];
+static simBus_t lastI2c;
+static simBus_t lastOneWire;
+
+static uint8_t phaseIndex()
+{
+  return powerPhaseNow < PHASE_COUNT ? powerPhaseNow : PHASE_COUNT;
+}
+
+static void elapse(uint64_t untilUs, bool awake)
+{
+  bool limit = limitUs > 0 && untilUs >= limitUs;
+  uint64_t us;
+
+  if (limit)
+  {
+    untilUs = limitUs;
+  }
+  us = untilUs - simRealUs;
+  simRealUs = untilUs;
+
+  if (awake)
+  {
+    simAwakeUs += us;
+    phaseUs[phaseIndex()] += us;
+  }
+  else
+  {
+    powerDownUs += us;
+  }
+
+  if (limit)
+  {
+    simFinish("time limit");
+  }
+}
+
+// Apply the next pin edge if it is due until the given time.
+// Returns 0 without edge, 1 for an edge and 2 if it caused an interrupt.
+static uint8_t nextEdge(uint64_t untilUs, bool awake)
+{
+  if (edgeNext >= edgeCount || edges[edgeNext].us > untilUs)
+  {
+    return 0;
+  }
+
+  edge_t &edge = edges[edgeNext++];
+  elapse(max(edge.us, simRealUs), awake);
+  return simPinEdge(edge.pin, edge.level) ? 2 : 1;
+}
+
+void simRun(uint32_t us)
+{
+  uint64_t endUs = simRealUs + us;
+
+  while (nextEdge(endUs, true))
+  {
+  }
+  elapse(endUs, true);
+}
+
+bool simPowerDown(uint64_t untilUs)
+{
+  uint8_t edge;
+
+  while ((edge = nextEdge(untilUs, false)))
+  {
+    if (edge == 2)
+    {
+      return true;
+    }
+  }
+
+  if (untilUs == UINT64_MAX)
+  {
+    simFinish("power down without wake-up source");
+  }
+  elapse(untilUs, false);
+  return false;
+}
+
+static void printMs(const char *name, uint64_t us)
+{
+  printf(" %s %.1f", name, us / 1000.0);
+}
+
+static void printBus(const char *name, const simBus_t &bus, const simBus_t &last)
+{
+  printf("%s %u transactions, %u bytes, %.1f ms", name, bus.transactions - last.transactions,
+         bus.bytes - last.bytes, (bus.us - last.us) / 1000.0);
+}
+
+void simUplink(uint8_t port, uint32_t fcnt, uint8_t attempts, const uint8_t *data, uint8_t len,
+               uint8_t txrxFlags, uint32_t txAirtimeUs)
+{
+  uplinks++;
+  portUplinks[min(port, MAX_PORTS - 1)]++;
+  airtimeUs += txAirtimeUs;
+
+  printf("[sim] %10.3f s #%u port %u, FCnt %u, %u bytes, %u TX, %s, airtime %.1f ms, awake %.1f ms:",
+         simRealUs / 1e6, uplinks, port, fcnt, len, attempts,
+         txrxFlags & TXRX_ACK ? "ACK" : (txrxFlags & TXRX_NACK ? "NACK" : "unconfirmed"),
+         txAirtimeUs / 1000.0, (simAwakeUs - lastAwakeUs) / 1000.0);
+  for (uint8_t i = 0; i <= PHASE_COUNT; i++)
+  {
+    printMs(phaseNames[i], phaseUs[i] - lastPhaseUs[i]);
+    lastPhaseUs[i] = phaseUs[i];
+  }
+  printf("\n[sim] ");
+  printBus("i2c", simI2c, lastI2c);
+  printBus(", 1-wire", simOneWire, lastOneWire);
+  lastI2c = simI2c;
+  lastOneWire = simOneWire;
+  printf("\n[sim] ");
+  for (uint8_t i = 0; i < len; i++)
+  {
+    printf("%02X", data[i]);
+  }
+  printf("\n");
+  lastAwakeUs = simAwakeUs;
+
+  if (simOnUplink)
+  {
+    simOnUplink(port, fcnt, attempts, data, len, txrxFlags);
+  }
+
+  if (maxUplinks > 0 && uplinks >= maxUplinks)
+  {
+    simFinish("uplink limit");
+  }
+}
+
+void simFinish(const char *reason)
+{
+  fflush(stdout);
+  printf("\n== Simulation end: %s ==\n", reason);
+  printf("Time          %12.3f s\n", simRealUs / 1e6);
+  printf("Power down    %12.3f s\n", powerDownUs / 1e6);
+  printf("Awake         %12.3f s (%.3f %%)\n", simAwakeUs / 1e6,
+         simRealUs ? simAwakeUs * 100.0 / simRealUs : 0.0);
+  for (uint8_t i = 0; i <= PHASE_COUNT; i++)
+  {
+    printf("  %-11s %12.3f s\n", phaseNames[i], phaseUs[i] / 1e6);
+  }
+  printf("Airtime       %12.3f s\n", airtimeUs / 1e6);
+  printBus("I2C           ", simI2c, simBus_t());
+  printBus("\n1-Wire        ", simOneWire, simBus_t());
+  printf("\n");
+  printf("Uplinks       %8u", uplinks);
+  for (uint8_t i = 0; i < MAX_PORTS; i++)
+  {
+    if (portUplinks[i])
+    {
+      printf(" (port %u: %u)", i, portUplinks[i]);
+    }
+  }
+  printf("\n");
+  if (uplinks)
+  {
+    printf("Awake/uplink  %12.1f ms\n", simAwakeUs / 1000.0 / uplinks);
+  }
+
+  if (eepromFile)
+  {
+    FILE *f = fopen(eepromFile, "wb");
+    if (!f || fwrite(EEPROM.data, sizeof(EEPROM.data), 1, f) != 1)
+    {
+      fprintf(stderr, "Can't write %s\n", eepromFile);
+    }
+    if (f)
+    {
+      fclose(f);
+    }
+  }
+
+  fflush(stdout);
+  exit(0);
+}
+
+void simAddEdge(uint64_t us, uint8_t pin, uint8_t level)
+{
+  uint8_t i = edgeCount;
+
+  if (edgeCount >= MAX_EDGES)
+  {
+    fprintf(stderr, "Too many pin edges\n");
+    exit(1);
+  }
+  // Keep the edges sorted by time
+  while (i > 0 && edges[i - 1].us > us)
+  {
+    edges[i] = edges[i - 1];
+    i--;
+  }
+  edges[i].us = us;
+  edges[i].pin = pin;
+  edges[i].level = level;
+  edgeCount++;
+}
+
+void simInit()
+{
+  memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+  memcpy(EEPROM.data, defaultConfig, sizeof(defaultConfig));
+
+  // Pulse counter inputs idle high (pull-up)
+  PIND = bit(4) | bit(5);
+}
+
+// The unit tests under test/ bring their own main() and drive the simulation
+#ifndef PIO_UNIT_TESTING
+
+// Interrupt pins get a high pulse, pulse counter pins idle high and get a low pulse
+static bool addPulse(const char *arg)
+{
+  char *end;
+  unsigned long pin = strtoul(arg, &end, 10);
+
+  if (*end != '@')
+  {
+    return false;
+  }
+  uint64_t us = (uint64_t)(strtod(end + 1, &end) * 1e6);
+  if (*end != '\0')
+  {
+    return false;
+  }
+
+  if (pin == 2 || pin == 3)
+  {
+    simAddEdge(us, pin, HIGH);
+    simAddEdge(us + ITR_PULSE_US, pin, LOW);
+  }
+  else if (pin == 4 || pin == 5)
+  {
+    simAddEdge(us, pin, LOW);
+    simAddEdge(us + COUNTER_PULSE_US, pin, HIGH);
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n N      Stop after N uplinks, 0 = no limit (default 10)\n"
+          "  -t S      Stop after S seconds\n"
+          "  -e FILE   EEPROM image, loaded at start (default config if missing) and saved at the end\n"
+          "  -i PIN@S  Pulse on pin 2/3 (interrupt) or 4/5 (pulse counter) after S seconds, repeatable\n"
+          "  -a ADC    Raw ADC reading of the battery voltage (default 700)\n"
+          "  -B        No BME280\n"
+          "  -m MS     Measurement time of the BME280 (default from the oversampling)\n"
+          "  -d [s]T   DS18B20 (DS18S20 with s) at T °C, repeatable (default one DS18B20 at 22.5 °C)\n"
+          "  -D        No DS18x probes\n"
+          "  -x        No network, confirmed uplinks get no ACK and joins fail\n"
+          "  -q        Don't print the serial output\n"
+          "In CONFIG_MODE builds the serial input is read from stdin, one line per input.\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  bool dsDefault = true;
+
+  maxUplinks = 10;
+
+  while ((opt = getopt(argc, argv, "n:t:e:i:a:Bm:d:Dxqh")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      maxUplinks = atoi(optarg);
+      break;
+    case 't':
+      limitUs = (uint64_t)(atof(optarg) * 1e6);
+      break;
+    case 'e':
+      eepromFile = optarg;
+      break;
+    case 'i':
+      if (!addPulse(optarg))
+      {
+        usage(argv[0]);
+      }
+      break;
+    case 'a':
+      simAdc = atoi(optarg);
+      break;
+    case 'B':
+      simBmePresent = false;
+      break;
+    case 'm':
+      simBmeMeasureUs = atof(optarg) * 1000;
+      break;
+    case 'd':
+      if (!simAddDs(optarg[0] == 's', (int16_t)(atof(optarg + (optarg[0] == 's')) * 100)))
+      {
+        usage(argv[0]);
+      }
+      dsDefault = false;
+      break;
+    case 'D':
+      dsDefault = false;
+      break;
+    case 'x':
+      simNoNetwork = true;
+      break;
+    case 'q':
+      simQuiet = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  simInit();
+  if (eepromFile)
+  {
+    FILE *f = fopen(eepromFile, "rb");
+    if (f)
+    {
+      if (fread(EEPROM.data, sizeof(EEPROM.data), 1, f) != 1)
+      {
+        fprintf(stderr, "Can't read %s\n", eepromFile);
+        return 1;
+      }
+      fclose(f);
+    }
+  }
+
+  if (dsDefault)
+  {
+    simAddDs(false, 2250);
+  }
+
+  setup();
+  while (true)
+  {
+    loop();
+  }
+}
+
+#endif
@@ -0,0 +1,75 @@
+// Native simulation of the node, see "Native simulation" in README.md
+#pragma once
+
+#include <stdint.h>
+
+// Real time since power up and the time the MCU was awake, in us.
+// millis()/micros() and the LMIC run on the awake time only, Timer0 stops in power down.
+extern uint64_t simRealUs;
+extern uint64_t simAwakeUs;
+
+// Simulation options, see usage() in sim.cpp
+extern bool simQuiet;     // Don't print the serial output
+extern bool simNoNetwork; // No gateway in range, uplinks get no ACK, joins fail
+extern uint16_t simAdc;   // Raw reading of the battery voltage divider
+
+// The MCU runs for the given time, pin edges in between are served
+void simRun(uint32_t us);
+
+// Power down until the given real time or the next pin edge.
+// Returns true if a pin edge woke the MCU.
+bool simPowerDown(uint64_t untilUs);
+
+// Called by the LMIC after an uplink is completed (including its RX windows),
+// with its frame counter and the transmissions including retries
+void simUplink(uint8_t port, uint32_t fcnt, uint8_t attempts, const uint8_t *data, uint8_t len,
+               uint8_t txrxFlags, uint32_t airtimeUs);
+
+// Called by simUplink() if set, the unit tests record the uplinks with it
+extern void (*simOnUplink)(uint8_t port, uint32_t fcnt, uint8_t attempts, const uint8_t *data, uint8_t len,
+                           uint8_t txrxFlags);
+
+// Payload of the last LMIC_setTxData2(), returns its length
+uint8_t simTxFrame(uint8_t *port, const uint8_t **data);
+
+// Print the report, save the EEPROM image and exit
+void simFinish(const char *reason);
+
+// Level change of a pin, returns true if an interrupt was served
+bool simPinEdge(uint8_t pin, uint8_t level);
+
+// Level change of a pin at the given real time, served while the MCU runs or powers down.
+// The edges must not be in the past.
+void simAddEdge(uint64_t us, uint8_t pin, uint8_t level);
+
+// Default config in the EEPROM and idle pin levels, done by main() before setup().
+// The unit tests under test/ call it instead of main().
+void simInit();
+
+// Traffic of a bus, transactions are I2C transfers or 1-Wire resets
+typedef struct
+{
+  uint32_t transactions;
+  uint32_t bytes;
+  uint64_t us;
+} simBus_t;
+
+extern simBus_t simI2c;
+extern simBus_t simOneWire;
+
+// Devices on the buses, see devices.cpp
+extern bool simBmePresent;        // BME280 at 0x76
+extern uint32_t simBmeMeasureUs;  // Measurement time of the BME280, 0 = typical time of the oversampling
+bool simAddDs(bool s20, int16_t temp100);
+void simDsConnect(uint8_t n, bool connected); // n-th probe added, a disconnected probe doesn't answer
+
+// I2C bus, returns the Wire status (0 = ACK, 2 = address NACK)
+uint8_t simI2cWrite(uint8_t address, const uint8_t *data, uint8_t len);
+uint8_t simI2cRead(uint8_t address, uint8_t *data, uint8_t len);
+
+// 1-Wire bus, reset returns the presence pulse
+bool simOneWireReset();
+void simOneWireWrite(uint8_t value);
+uint8_t simOneWireRead();
+// n-th device of a (conditional) search
+bool simOneWireSearch(uint8_t n, bool alarmOnly, uint8_t *rom);
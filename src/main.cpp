@@ -9,6 +9,9 @@
 #include <TinyBME.h>
 #include <EEPROM.h>
 #include <CRC32.h>
+#include <avr/sleep.h>
+#include <avr/power.h>
+#include <avr/wdt.h>
 
 // ++++++++++++++++++++++++++++++++++++++++
 //
@@ -30,40 +33,239 @@
 #define INTERRUPT_PIN0 2
 #define INTERRUPT_PIN1 3
 
+// Pulse counter pins (spare GPIOs, both on port D / PCINT2)
+#define PULSE_PIN0 4
+#define PULSE_PIN1 5
+#define PULSE_COUNTER_NUM 2
+
 // Battery
 #define BAT_SENSE_PIN A0 // Analoge Input Pin
 
+// Phase marker, toggles on every power phase change to split a current trace
+// into the phases. Enable with -D PHASE_MARKER_PIN=A1 in the build flags.
+// #define PHASE_MARKER_PIN A1
+
+// Max. DS18x sensors on the 1-Wire bus
+#define DS_MAX_SENSORS 8
+#define DS_SINGLE 0xFF // writeSample(): Only the first probe, without the number of probes
+
 // BME I2C Adresses
 #define I2C_ADR_BME 0x76
 
+// Time budgets of the sensor readouts, a stuck sensor must not drain the battery
+#define I2C_TIMEOUT_US 25000 // Per I2C transfer
+#define BME_BUDGET_MS 100 // Forced measurement and readout (about 10 ms with 1x oversampling)
+#define DS_BUDGET_MS 1000 // Conversion (750 ms) and readout of all probes
+#define SENSOR_MAX_FAILS 3 // Failed readouts in a row until a sensor is skipped
+#define SENSOR_MAX_BACKOFF 6 // Skip at most 2^6 readouts
+
 // Voltage calibration interval
 #define VOL_DEBUG_INTERVAL 1000 // in ms
 
 // Start address in EEPROM for structure 'cfg'
 #define CFG_START 0
 
+// Sensor inventory of the last full probe, see probeSensors()
+#define SENSOR_CACHE_START 128
+
+// Backlog ring in EEPROM for samples not acknowledged by the network
+#define BACKLOG_START 256 // Wear counter (4 bytes), followed by the slots
+#define BACKLOG_END RESET_LOG_START
+#define BACKLOG_MAX_WEAR 90000 // Stop writing before the EEPROM endurance (100,000 cycles) is reached
+#define BACKLOG_MAX_FRAME 64 // Max. size of a catch-up frame, limits the stack usage
+
+// Reset counters and the trace of the last warm reset, see resetLog_t
+#define RESET_LOG_START 976 // Up to the end of the EEPROM (1024 bytes)
+
+// Trace ring of the last state machine events, survives warm resets (see trace())
+#define TRACE_SIZE 16
+#define TRACE_MAGIC 0x7A3C
+#define TRACE_BAT_MV 32 // Battery voltage per step of TRACE_BAT_LOW, one byte holds up to 8160 mV
+
 // Config size
-#define CFG_SIZE 82
-#define CFG_SIZE_WITH_CHECKSUM 86
+#define CFG_SIZE 101
+#define CFG_SIZE_WITH_CHECKSUM 105
 
 // LORA MAX RANDOM SEND DELAY
 #define LORA_MAX_RANDOM_SEND_DELAY 20
 
+// LoRaWAN FPorts
+#define DATA_FPORT 1 // Full telemetry
+#define EVENT_FPORT 2 // Minimal event frame (fast path)
+#define BACKLOG_FPORT 3 // Catch-up frame with samples from the backlog
+#define DIAG_FPORT 4 // Diagnostics frame, see DIAG_INTERVAL
+
+// Fill byte of the free RAM, see stackPaint()
+#define STACK_CANARY 0xC5
+
+// Pin event queue
+#define EVENT_QUEUE_SIZE 8 // Max. pin events per uplink
+#define EVENT_DEBOUNCE_MS 50 // Edges on the same pin within this time are ignored
+#define EVENT_MAX_AGE 0x7FFF // Max. age of a pin event in the payload (in 0.1 s)
+
+// The watchdog timer runs slow (see do_sleep()), so one second of sleep lasts about 1136 ms
+#define SLEEP_MS_PER_S 1136
+
+// Number of ADC readings mixed into the random seed
+#define SEED_ADC_READINGS 16
+
+// Link quality of the last ACK used to derive the confirmed uplink retries
+#define LINK_SNR_GOOD 5 // in dB, good link margin, a single retry is enough
+#define LINK_RSSI_GOOD -100 // in dBm, good link margin, a single retry is enough
+#define LINK_SNR_MEDIUM -5 // in dB, medium link margin, half of the configured retries
+
 // ++++++++++++++++++++++++++++++++++++++++
 //
 // LOGGING
 //
 // ++++++++++++++++++++++++++++++++++++++++
 
+// log_e(LOG_..., args) logs an event of include/logevents.h, one line per event.
+// With LOG_TOKENS (debug env) only the index of the event and its arguments are
+// sent, decode them with tools/log_decode.py. That keeps the serial output of a
+// wakeup to a few bytes, so debug builds are awake about as long as release builds.
+#if defined(LOG_TOKENS) && defined(CONFIG_MODE)
+#error "LOG_TOKENS can't be used in config mode, the config menu is text"
+#endif
+
 #ifdef LOG_DEBUG
-#define log_d(s, ...) Serial.print(s, ##__VA_ARGS__);
-#define log_d_ln(s, ...) Serial.println(s, ##__VA_ARGS__);
-#define logHex_d(b, c) printHex(b, c);
+#define log_e(id, ...) logEvent(id, ##__VA_ARGS__);
 const boolean LOG_DEBUG_ENABLED = true;
+
+enum _LogEvent
+{
+#define LOG_EVENT(id, text) id,
+#include "logevents.h"
+#undef LOG_EVENT
+};
+
+// Bytes logged as hex (%h)
+typedef struct
+{
+  const byte *buf;
+  uint8_t len;
+} logBytes_t;
+
+logBytes_t logBytes(const byte *buf, uint8_t len)
+{
+  logBytes_t bytes = {buf, len};
+  return bytes;
+}
+
+#ifdef LOG_TOKENS
+// Record: LOG_SYNC, event index, arguments as varints (7 bits per byte,
+// LSB first, bit 7 set if more bytes follow). Numbers are zigzag encoded
+// (0, -1, 1, -2, ...), %h is the length followed by the bytes.
+#define LOG_SYNC 0xA5
+
+void logVarint(uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    Serial.write((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  Serial.write((uint8_t)value);
+}
+
+// Unsigned values above 2^31 are sent as negative values,
+// the decoder takes the lower 32 bits of %u and %x
+void logValue(int32_t value)
+{
+  logVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+void logValue(logBytes_t bytes)
+{
+  logVarint(bytes.len);
+  Serial.write(bytes.buf, bytes.len);
+}
+
+void logValues()
+{
+}
+
+template <typename T, typename... Args>
+void logValues(T value, Args... args)
+{
+  logValue(value);
+  logValues(args...);
+}
+
+template <typename... Args>
+void logEvent(uint8_t id, Args... args)
+{
+  Serial.write(LOG_SYNC);
+  Serial.write(id);
+  logValues(args...);
+}
+#else
+// Texts of the events in flash
+#define LOG_EVENT(id, text) const char logText_##id[] PROGMEM = text;
+#include "logevents.h"
+#undef LOG_EVENT
+
+const char *const logTexts[] PROGMEM = {
+#define LOG_EVENT(id, text) logText_##id,
+#include "logevents.h"
+#undef LOG_EVENT
+};
+
+void printHex(byte buffer[], size_t arraySize);
+
+// Print the text up to the next argument. Returns the type of the
+// argument (u, d, x or h) or 0 at the end of the text.
+char logText(const char *&text)
+{
+  char c;
+  while ((c = pgm_read_byte(text++)) != '\0')
+  {
+    if (c == '%')
+    {
+      return pgm_read_byte(text++);
+    }
+    Serial.write(c);
+  }
+  text--;
+  return 0;
+}
+
+template <typename T>
+void logValue(char type, T value)
+{
+  Serial.print(value, type == 'x' ? HEX : DEC);
+}
+
+void logValue(char type, logBytes_t bytes)
+{
+  printHex((byte *)bytes.buf, bytes.len);
+}
+
+void logValues(const char *text)
+{
+  logText(text);
+  Serial.println();
+}
+
+template <typename T, typename... Args>
+void logValues(const char *text, T value, Args... args)
+{
+  char type = logText(text);
+  if (type)
+  {
+    logValue(type, value);
+  }
+  logValues(text, args...);
+}
+
+template <typename... Args>
+void logEvent(uint8_t id, Args... args)
+{
+  logValues((const char *)pgm_read_ptr(&logTexts[id]), args...);
+}
+#endif
 #else
-#define log_d(s, ...)
-#define log_d_ln(s, ...)
-#define logHex_d(b, c)
+#define log_e(id, ...)
 const boolean LOG_DEBUG_ENABLED = false;
 #endif
 
@@ -78,7 +280,10 @@ TinyDallas ds(&oneWire);
 TinyBME bme;
 
 // Dallas temp sensor(s)
-DeviceAddress dsSensor; // Holds later first sensor found at boot.
+DeviceAddress dsSensors[DS_MAX_SENSORS]; // Sensors found at boot, ordered by ROM code
+uint8_t dsCount = 0;                     // Number of sensors in dsSensors
+int16_t dsTemps[DS_MAX_SENSORS];         // Temperatures of the last readout
+uint8_t dsAlarms = 0;                    // Probes in alarm after the last readout, bit i = dsSensors[i]
 
 // ++++++++++++++++++++++++++++++++++++++++
 //
@@ -92,11 +297,48 @@ enum _activationMethode
   ABP = 2
 };
 
+enum _configValid
+{
+  CONFIG_INVALID = 0,
+  CONFIG_VALID_FLOAT = 1, // Battery values as float, migrated by readConfig()
+  CONFIG_VALID = 2        // Battery values as integer
+};
+
+enum _confirmedDataUp
+{
+  UNCONFIRMED = 0,
+  CONFIRMED = 1,
+  CONFIRMED_ADAPTIVE = 2
+};
+
 enum _StateByte
 {
   STATE_ITR_TRIGGER = 0b0001,
   STATE_ITR0 = 0b0010,
   STATE_ITR1 = 0b0100,
+  STATE_BLOCKS = 0b1000, // Payload uses the block layout (see _PayloadBlock)
+};
+
+// Blocks of the payload. Bit set in the content byte if the block is present.
+// The blocks follow the content byte in the order of their bits.
+enum _PayloadBlock
+{
+  BLOCK_BAT = 0b0001,    // 2 bytes - Battery voltage
+  BLOCK_BME = 0b0010,    // 6 bytes - BME temperature, humidity and pressure
+  BLOCK_DS = 0b0100,     // 1 + n * 2 bytes - DS18x temperatures (2 bytes in catch-up frames)
+  BLOCK_EVENTS = 0b1000, // 1 + n * 2 bytes - Pin events
+  BLOCK_PULSE = 0b10000, // 1 + n * 2 bytes - Pulse counter deltas
+  BLOCK_STATS = 0b100000, // 2 + n * 6 bytes - Min, max and mean of the BME and DS18x values since the last uplink
+  BLOCK_STATUS = 0b1000000, // 2 bytes - Status of the BME and DS18x, only sent if one of them failed
+  BLOCK_DS_ALARM = 0b10000000, // 1 + n * 2 bytes - DS18x probes in alarm (bit mask) and their temperatures
+};
+
+// Blocks of the diagnostics frame, same layout as _PayloadBlock
+enum _DiagBlock
+{
+  DIAG_STACK = 0b0001, // 2 bytes - RAM never reached by the stack since boot
+  DIAG_CYCLE = 0b0010, // 27 bytes - Times and charge of the last cycle, charge since boot
+  DIAG_RESET = 0b0100, // 11 bytes - Flags (MCUSR) of the last reset, resets per cause
 };
 
 // ++++++++++++++++++++++++++++++++++++++++
@@ -120,14 +362,16 @@ const lmic_pinmap lmic_pins = {
     .dio = {LORA_DIO0, LORA_DIO1, LORA_DIO2},
 };
 
+// Layout of the config in EEPROM. Only the fields of config_t are kept in RAM,
+// the keys and EUIs are read from EEPROM on demand (see readConfigKey()).
 typedef struct
 {
   uint8_t CONFIG_IS_VALID;          // 1 byte
   uint16_t SLEEPTIME;               // 2 byte - (Deep) Sleep time between data acquisition and transmission
-  float BAT_SENSE_VPB;              // 4 byte - Volts per Bit. See documentation
-  float BAT_MIN_VOLTAGE;            // 4 byte - Minimum voltage for operation, otherwise the node continues to sleep
+  uint32_t BAT_SENSE_UVPB;          // 4 byte - Microvolts per Bit. See documentation
+  uint32_t BAT_MIN_MV;              // 4 byte - Minimum voltage in mV for operation, otherwise the node continues to sleep
   uint8_t WAKEUP_BY_INTERRUPT_PINS; // 1 byte - 0 = Disabled, 1 = Enabled
-  uint8_t CONFIRMED_DATA_UP;        // 1 byte - 0 = Unconfirmed Data Up, 1 = Confirmed Data Up
+  uint8_t CONFIRMED_DATA_UP;        // 1 byte - 0 = Unconfirmed Data Up, 1 = Confirmed Data Up, 2 = Adaptive
   uint8_t ACTIVATION_METHOD;        // 1 byte - 1 = OTAA, 2 = ABP
 
   // ABP
@@ -139,8 +383,225 @@ typedef struct
   u1_t DEVEUI[8];  //  8 byte - EUIs must be in little-endian format, so least-significant-byte (aka lsb)
   u1_t APPKEY[16]; // 16 byte - AppSKey, application session key in big-endian format (aka msb).
 
+  // Adaptive confirmed data up
+  uint8_t CONFIRM_EVERY_N; // 1 byte - Confirm every Nth periodic uplink, 0 = only interrupt triggered uplinks
+  uint8_t CONFIRM_RETRIES; // 1 byte - Max. retransmissions of a confirmed uplink without ACK (0-7)
+
+  uint8_t TX_SLOTTED;      // 1 byte - 0 = Random send delay, 1 = Fixed send slot derived from DEVEUI/DEVADDR
+  uint8_t EVENT_FAST_PATH; // 1 byte - 0 = Full telemetry on interrupt, 1 = Minimal event frame on interrupt
+  uint8_t EVENT_COALESCE;  // 1 byte - Time in s to collect further pin events before sending them in one uplink
+  uint8_t PULSE_COUNTERS;  // 1 byte - Bit 0 = Pulse counter on D4, Bit 1 = Pulse counter on D5
+
+  // Sensor profiles, Bit 0 = Battery, Bit 1 = BME, Bit 2 = DS18x (see _PayloadBlock)
+  uint8_t SENSORS_PERIODIC; // 1 byte - Sensors read on periodic wakeups
+  uint8_t SENSORS_ITR0;     // 1 byte - Sensors read on wakeups by interrupt pin 0
+  uint8_t SENSORS_ITR1;     // 1 byte - Sensors read on wakeups by interrupt pin 1
+  uint8_t BAT_INTERVAL;     // 1 byte - Read battery only every Nth uplink, 0 or 1 = every uplink
+
+  uint8_t BACKLOG; // 1 byte - 0 = Disabled, 1 = Store unacknowledged samples and send them when the link is back (confirms all full telemetry uplinks)
+
+  uint16_t STATS_INTERVAL; // 2 byte - Sample interval in s for min/max/mean between uplinks, 0 = Disabled
+
+  uint8_t DS_ALARM;         // 1 byte - 0 = Disabled, 1 = Read only the first DS18x probe and the probes in alarm
+  int8_t DS_ALARM_HIGH;     // 1 byte - High alarm temperature of the DS18x probes in °C
+  int8_t DS_ALARM_LOW;      // 1 byte - Low alarm temperature of the DS18x probes in °C
+  uint16_t ALARM_SLEEPTIME; // 2 byte - Sleep time while a DS18x alarm is active, 0 = SLEEPTIME
+
+  uint8_t DIAG_INTERVAL; // 1 byte - Send a diagnostics frame after every Nth periodic uplink, 0 = Disabled
+
 } configData_t;
-configData_t cfg; // Instance 'cfg' is a global variable with 'configData_t' structure now
+
+// Keys and EUIs, not kept in RAM
+#define CFG_KEYS_START offsetof(configData_t, NWKSKEY)
+#define CFG_KEYS_END offsetof(configData_t, CONFIRM_EVERY_N)
+
+// Offset and size of a key field, see readConfigKey()
+#define CFG_KEY(field) offsetof(configData_t, field), sizeof(((configData_t *)0)->field)
+
+// Resident config: configData_t without the keys, in the same order
+typedef struct
+{
+  uint8_t CONFIG_IS_VALID;
+  uint16_t SLEEPTIME;
+  uint32_t BAT_SENSE_UVPB;
+  uint32_t BAT_MIN_MV;
+  uint8_t WAKEUP_BY_INTERRUPT_PINS;
+  uint8_t CONFIRMED_DATA_UP;
+  uint8_t ACTIVATION_METHOD;
+  uint8_t CONFIRM_EVERY_N;
+  uint8_t CONFIRM_RETRIES;
+  uint8_t TX_SLOTTED;
+  uint8_t EVENT_FAST_PATH;
+  uint8_t EVENT_COALESCE;
+  uint8_t PULSE_COUNTERS;
+  uint8_t SENSORS_PERIODIC;
+  uint8_t SENSORS_ITR0;
+  uint8_t SENSORS_ITR1;
+  uint8_t BAT_INTERVAL;
+  uint8_t BACKLOG;
+  uint16_t STATS_INTERVAL;
+  uint8_t DS_ALARM;
+  int8_t DS_ALARM_HIGH;
+  int8_t DS_ALARM_LOW;
+  uint16_t ALARM_SLEEPTIME;
+  uint8_t DIAG_INTERVAL;
+} config_t;
+static_assert(sizeof(config_t) == CFG_SIZE - (CFG_KEYS_END - CFG_KEYS_START), "config_t must match configData_t");
+config_t cfg; // Instance 'cfg' is a global variable with 'config_t' structure now
+
+typedef struct
+{
+  uint32_t time; // Node time in ms, see nodeTime()
+  uint8_t pin;   // 0 = ITR0, 1 = ITR1
+} pinEvent_t;
+
+typedef struct
+{
+  uint32_t time;   // Node time in s
+  uint8_t content; // Blocks with values, see _PayloadBlock
+  uint16_t bat;
+  int16_t temp1;
+  uint16_t humi1;
+  uint16_t press1;
+  int16_t temp2;
+} sample_t;
+
+typedef struct
+{
+  uint16_t seq; // BACKLOG_EMPTY = free slot
+  sample_t sample;
+} backlogRecord_t;
+
+// Window statistics of one value, integer only
+typedef struct
+{
+  int16_t min;
+  int16_t max;
+  int32_t sum;
+} stat_t;
+
+enum _StatValue
+{
+  STAT_TEMP1,
+  STAT_HUMI1,
+  STAT_PRESS1,
+  STAT_TEMP2,
+  STAT_NUM
+};
+
+#define BACKLOG_EMPTY 0xFFFF
+#define BACKLOG_SLOTS ((BACKLOG_END - BACKLOG_START - sizeof(uint32_t)) / sizeof(backlogRecord_t))
+
+// Cause of a reset, from the reset flags (see resetCause())
+enum _ResetCause
+{
+  RESET_POWER_ON,
+  RESET_EXTERNAL,
+  RESET_BROWN_OUT,
+  RESET_WATCHDOG,
+  RESET_OTHER, // No flag: Jump to the reset vector or flags cleared by the bootloader
+  RESET_NUM
+};
+
+// Events of the trace ring, the argument is in the comment
+enum _TraceEvent
+{
+  TRACE_BOOT = 1, // Reset flags
+  TRACE_SLEEP,    // Sleep time in s / 256 (0 = forever or less than 256 s)
+  TRACE_WAKE,     // Bit 0 = ItrPin 0, Bit 1 = ItrPin 1, 0 = Timer
+  TRACE_BAT_LOW,  // Battery in mV / TRACE_BAT_MV
+  TRACE_SENSORS,  // Sensor profile, see _PayloadBlock
+  TRACE_QUEUED,   // FPort of the uplink
+  TRACE_LMIC,     // LMIC event (ev_t)
+};
+
+typedef struct
+{
+  uint8_t event; // See _TraceEvent
+  uint8_t arg;
+} traceEntry_t;
+
+// Trace ring in .noinit RAM, not cleared at reset
+typedef struct
+{
+  uint16_t magic; // TRACE_MAGIC if the ring is valid
+  uint8_t head;   // Index of the oldest entry
+  uint8_t len;    // Number of entries
+  traceEntry_t entry[TRACE_SIZE];
+} trace_t;
+
+// Reset log in EEPROM, updated at every boot
+typedef struct
+{
+  uint8_t flags;                  // Reset flags (MCUSR) of the last reset
+  uint16_t count[RESET_NUM];      // Resets per cause, see _ResetCause
+  uint8_t traceLen;               // Entries of the trace, oldest first
+  traceEntry_t trace[TRACE_SIZE]; // Trace ring before the last warm reset
+  uint32_t crc;                   // CRC32 of the fields above
+} resetLog_t;
+static_assert(RESET_LOG_START + sizeof(resetLog_t) <= E2END + 1, "resetLog_t must fit into the EEPROM");
+
+// Health of a sensor, a failing sensor is skipped for a backoff period
+typedef struct
+{
+  uint8_t fails;   // Failed readouts in a row
+  uint8_t backoff; // Readouts left to skip
+} sensorHealth_t;
+
+enum _Sensor
+{
+  SENSOR_BME,
+  SENSOR_DS,
+  SENSOR_NUM
+};
+
+// Power phases, each phase clocks only the peripherals it needs (see powerPhase())
+enum _PowerPhase
+{
+  PHASE_SLEEP,   // Power down, nothing
+  PHASE_AWAKE,   // LMIC: SPI, Timer0
+  PHASE_ADC,     // Battery: ADC
+  PHASE_TWI,     // BME280: TWI
+  PHASE_ONEWIRE, // DS18x: Bit-banged, Timer0 only
+  PHASE_ENCODE,  // Building an uplink: Same as PHASE_AWAKE, timed separately
+  PHASE_NUM
+};
+
+// Times of a cycle: the power phases, followed by the radio
+#define TIME_TX PHASE_NUM       // Airtime of all transmissions
+#define TIME_RX (PHASE_NUM + 1) // Receive windows after the transmissions
+#define TIME_NUM (PHASE_NUM + 2)
+
+// Last cycle, from the end of one data or event uplink to the next (see cycleEnd())
+typedef struct
+{
+  uint16_t time[TIME_NUM]; // in ms, PHASE_SLEEP in s
+  uint8_t txAttempts;      // Transmissions including retries and joins
+  uint32_t charge;         // Estimated charge in µC
+} cycle_t;
+
+// Sensors found by the last full probe, allows to skip the probe at boot
+typedef struct
+{
+  uint8_t dsCount;                         // DS18x sensors on the bus
+  DeviceAddress dsSensors[DS_MAX_SENSORS]; // Ordered by ROM code
+  uint8_t bme;                             // 1 = BME280 found
+  bme280_calib_data bmeCalib;              // Factory-set coefficients of the BME280
+  uint32_t crc;                            // CRC32 of the fields above
+} sensorCache_t;
+
+// Ring buffer of debounced pin events, filled from wakeUp0()/wakeUp1()
+volatile pinEvent_t eventQueue[EVENT_QUEUE_SIZE];
+volatile uint8_t eventHead = 0;         // Index of the oldest event
+volatile uint8_t eventLen = 0;          // Number of queued events
+volatile boolean eventsDropped = false; // Queue overflow, the oldest events were overwritten
+volatile uint32_t lastEdgeTime[2];      // Debounce per pin
+volatile uint32_t sleptMs = 0;          // Time spent in power down, millis() doesn't count it
+
+// Pulse counters, incremented on falling edges during power down
+volatile uint32_t pulseCount[PULSE_COUNTER_NUM];
+volatile uint8_t pulsePins;              // Last state of port D
+uint32_t pulseReported[PULSE_COUNTER_NUM]; // Counts already sent
 
 volatile boolean wakedFromISR0 = false;
 volatile boolean wakedFromISR1 = false;
@@ -151,19 +612,58 @@ boolean foundBME = false; // BME Sensor found. To skip reading if no sensor is a
 boolean foundDS = false;  // DS19x Sensor found. To skip reading if no sensor is attached
 byte pinState = 0x0;
 boolean doSend = false;
+uint8_t uplinksSinceConfirm = 0; // Periodic uplinks since the last confirmed uplink
+boolean ackReceived = false;     // At least one ACK received, lastAck* is valid
+int8_t lastAckSnr = 0;           // SNR of the last ACK in dB
+int16_t lastAckRssi = 0;         // RSSI of the last ACK in dBm
+uint8_t uplinksSinceBat = 0;     // Uplinks since the battery was read, see BAT_INTERVAL
+uint8_t txPort = 0;              // FPort of the current uplink
+uint8_t txRetries = 0;           // Retransmissions allowed for the current uplink, see limitRetries()
+sample_t lastSample;             // Sample of the current uplink, stored in the backlog if not acknowledged
+uint8_t backlogHead = 0;         // Slot of the oldest sample
+uint8_t backlogLen = 0;          // Samples in the backlog
+uint16_t backlogSeq = 0;         // Sequence number of the next sample
+uint32_t backlogWear = 0;        // Writes per slot (ring laps)
+uint8_t backlogSent = 0;         // Samples in the current catch-up frame
+boolean doSendBacklog = false;
+uint8_t uplinksSinceDiag = 0;    // Periodic uplinks since the last diagnostics frame
+boolean doSendDiag = false;
+stat_t stats[STAT_NUM];          // Window statistics since the last uplink
+uint8_t statsCount = 0;          // Samples in the window
+uint8_t statsContent = 0;        // Blocks in the window, see _PayloadBlock
+sensorHealth_t health[SENSOR_NUM]; // Health of the BME and DS18x, see _Sensor
+uint8_t powerPhaseNow = PHASE_NUM;   // Current power phase, see _PowerPhase
+ostime_t phaseSince = 0;         // Start of the current power phase
+uint32_t cycleTicks[TIME_NUM];   // Times of the current cycle in LMIC ticks, the sleep is in sleptMs
+uint32_t cycleSleptMs = 0;       // sleptMs at the start of the current cycle
+uint8_t txAttempts = 0;          // Transmissions in the current cycle
+ostime_t txStart = 0;            // Start of the current transmission
+boolean txTimed = true;          // Time of the current transmission added
+cycle_t lastCycle;               // Sent in the diagnostics frame
+uint32_t chargeTotal = 0;        // Estimated charge since boot in mC
+uint16_t chargeRest = 0;         // in µC, not yet added to chargeTotal
+uint16_t cycleCount = 0;         // Cycles since boot
+uint16_t slotOffset = 0;         // Offset of the send slot in s, added once to the first sleep
+uint16_t sleepRemaining = 0;     // Remaining sleep time in s after an interrupt, resumed after an event frame
+uint8_t eventCount = 0; // Sent event frames, allows the backend to detect lost events
+#ifdef LOG_DEBUG
+volatile unsigned long isrMicros = 0; // Time of the last interrupt, to measure the latency until TX start
+boolean firstTxStarted = false;       // Boot to first TX time logged
+#endif
 
 // These callbacks are used in over-the-air activation
+void readConfigKey(uint8_t offset, uint8_t size, void *buf);
 void os_getArtEui(u1_t *buf)
 {
-  memcpy(buf, cfg.APPEUI, 8);
+  readConfigKey(CFG_KEY(APPEUI), buf);
 }
 void os_getDevEui(u1_t *buf)
 {
-  memcpy(buf, cfg.DEVEUI, 8);
+  readConfigKey(CFG_KEY(DEVEUI), buf);
 }
 void os_getDevKey(u1_t *buf)
 {
-  memcpy(buf, cfg.APPKEY, 16);
+  readConfigKey(CFG_KEY(APPKEY), buf);
 }
 
 // ++++++++++++++++++++++++++++++++++++++++
@@ -180,319 +680,1717 @@ void clearSerialBuffer()
   }
 }
 
-void wakeUp0()
+// Time in ms since boot including the time spent in power down.
+// The resolution during power down is one sleep period (up to 8 s). A period
+// ended early by an interrupt pin is not counted, the watchdog can't tell how
+// much of it elapsed. Pin events are stamped at the start of that period, so
+// their age stays right and the clock lags by less than a period per pin wakeup.
+uint32_t nodeTime()
 {
-  wakedFromISR0 = true;
+  uint32_t slept;
+  noInterrupts();
+  slept = sleptMs;
+  interrupts();
+  return millis() + slept;
 }
 
-void wakeUp1()
-{
-  wakedFromISR1 = true;
-}
+#ifdef __AVR__
+extern uint8_t _end;    // End of the static variables, the heap is not used
+extern uint8_t __stack; // RAMEND, the stack grows down from here
 
-float readBat()
+// Fill the RAM between the static variables and the stack with STACK_CANARY
+// at reset, so stackFree() finds the lowest address the stack ever reached.
+// Runs in .init1 before the stack pointer and r1 are set up, so no C code.
+void stackPaint() __attribute__((naked, used, section(".init1")));
+void stackPaint()
 {
-  uint16_t value = 0;
-  uint8_t numReadings = 5;
+  asm volatile("    ldi r30, lo8(_end)\n"
+               "    ldi r31, hi8(_end)\n"
+               "    ldi r24, %0\n"
+               "    ldi r25, hi8(__stack)\n"
+               "    rjmp 2f\n"
+               "1:  st Z+, r24\n"
+               "2:  cpi r30, lo8(__stack)\n"
+               "    cpc r31, r25\n"
+               "    brlo 1b\n"
+               "    breq 1b\n"
+               :
+               : "M"(STACK_CANARY));
+}
+#endif
 
-  for (uint8_t i = 0; i < numReadings; i++)
-  {
-    value = value + analogRead(BAT_SENSE_PIN);
+#ifdef __AVR__
+#define NOINIT __attribute__((section(".noinit")))
+#else
+#define NOINIT
+#endif
 
-    // 1ms pause adds more stability between reads.
-    delay(1);
-  }
+uint8_t resetFlags NOINIT; // Reset flags (MCUSR) of the last reset
+trace_t traceRing NOINIT;  // Last state machine events, see trace()
 
-  value = value / numReadings;
+#ifdef __AVR__
+#define RESET_FLAGS (bit(WDRF) | bit(BORF) | bit(EXTRF) | bit(PORF))
 
-  float batteryV = value * cfg.BAT_SENSE_VPB;
-  if (CONFIG_MODE_ENABLED)
+// Save the reset flags before the C runtime starts. After a watchdog reset the
+// watchdog stays enabled until WDRF is cleared. The bootloader of the Pro Mini
+// leaves MCUSR. Only Optiboot clears it and passes it in r2, with any other
+// bootloader, without one (ISP) or after a jump to 0, r2 holds garbage. So r2 is
+// only taken if it holds one reset flag (or PORF with others), else the cause is
+// RESET_OTHER.
+void resetCapture() __attribute__((naked, used, section(".init3")));
+void resetCapture()
+{
+  uint8_t flags = MCUSR & RESET_FLAGS;
+  if (flags == 0)
   {
-    Serial.print(F("Analoge voltage: "));
-    Serial.print(((1.1 / 1024.0) * value), 2);
-    Serial.print(F(" V | Analoge value: "));
-    Serial.print(value);
-    Serial.print(F(" ("));
-    Serial.print(((100.0 / 1023.0) * value), 1);
-    Serial.print(F("% of Range) | Battery voltage: "));
-    Serial.print(batteryV, 1);
-    Serial.print(F(" V ("));
-    Serial.print(batteryV, 2);
-    Serial.print(F(" V, VPB="));
-    Serial.print(cfg.BAT_SENSE_VPB, 10);
-    Serial.println(F(")"));
+    asm volatile("mov %0, r2" : "=r"(flags));
+    if ((flags & ~RESET_FLAGS) || ((flags & (flags - 1)) && !(flags & bit(PORF))))
+    {
+      flags = 0;
+    }
   }
-
-  return batteryV;
+  resetFlags = flags;
+  MCUSR = 0;
+  wdt_disable();
 }
+#endif
 
-void printHex(byte buffer[], size_t arraySize)
+// Bytes of RAM the stack never reached since boot (high-water mark)
+uint16_t stackFree()
 {
-  unsigned c;
-  for (size_t i = 0; i < arraySize; i++)
+#ifdef __AVR__
+  const uint8_t *p = &_end;
+  while (p < &__stack && *p == STACK_CANARY)
   {
-    c = buffer[i];
+    p++;
+  }
+  return p - &_end;
+#else
+  return 0; // Not measured in the native simulation
+#endif
+}
 
-    if (i != 0)
-      Serial.write(32); // Space
+// Append an event to the trace ring, the oldest event is overwritten
+void trace(uint8_t event, uint8_t arg)
+{
+  traceEntry_t &entry = traceRing.entry[(traceRing.head + traceRing.len) % TRACE_SIZE];
+  entry.event = event;
+  entry.arg = arg;
+  if (traceRing.len < TRACE_SIZE)
+  {
+    traceRing.len++;
+  }
+  else
+  {
+    traceRing.head = (traceRing.head + 1) % TRACE_SIZE;
+  }
+}
 
-    c &= 0xff;
-    if (c < 16)
-      Serial.write(48); // 0
-    Serial.print(c, HEX);
+uint8_t resetCause(uint8_t flags)
+{
+  if (flags & bit(PORF))
+  {
+    return RESET_POWER_ON;
+  }
+  if (flags & bit(WDRF))
+  {
+    return RESET_WATCHDOG;
   }
+  if (flags & bit(BORF))
+  {
+    return RESET_BROWN_OUT;
+  }
+  if (flags & bit(EXTRF))
+  {
+    return RESET_EXTERNAL;
+  }
+  return RESET_OTHER;
 }
 
-void readConfig()
+// Returns false if the CRC of the reset log is invalid
+boolean readResetLog(resetLog_t &log)
 {
-  EEPROM.get(CFG_START, cfg);
+  EEPROM.get(RESET_LOG_START, log);
+  return CRC32::calculate((byte *)&log, offsetof(resetLog_t, crc)) == log.crc;
 }
 
-void setConfig()
+// Count the reset by its cause. After a warm reset, the trace ring still holds
+// the events before the reset, they are kept in the reset log. At power on
+// the RAM is random, the ring starts empty and the log keeps the old trace.
+void resetInit()
 {
-  byte cfgbuffer[CFG_SIZE_WITH_CHECKSUM];
-  char buffer[3];
-  char *pEnd;
-  uint32_t crc_data = 0;
-  CRC32 crc;
+  resetLog_t log;
 
-  for (uint8_t i = 0; i < CFG_SIZE_WITH_CHECKSUM; i++)
+#ifndef __AVR__
+  resetFlags = MCUSR; // Set by the native simulation
+#endif
+
+  if (!readResetLog(log))
   {
-    if (!Serial.readBytes(buffer, 2))
+    memset(&log, 0, sizeof(log));
+  }
+  uint8_t cause = resetCause(resetFlags);
+  log.flags = resetFlags;
+  if (log.count[cause] < 0xFFFF)
+  {
+    log.count[cause]++;
+  }
+
+  if (!(resetFlags & bit(PORF)) && traceRing.magic == TRACE_MAGIC &&
+      traceRing.head < TRACE_SIZE && traceRing.len <= TRACE_SIZE)
+  {
+    log.traceLen = traceRing.len;
+    for (uint8_t i = 0; i < traceRing.len; i++)
     {
-      break;
+      log.trace[i] = traceRing.entry[(traceRing.head + i) % TRACE_SIZE];
     }
+  }
+  else
+  {
+    traceRing.magic = TRACE_MAGIC;
+    traceRing.head = 0;
+    traceRing.len = 0;
+  }
 
-    // added null-terminator for strtol
-    buffer[3] = '\0';
-
-    // convert null-terminated char buffer with hex values to int
-    cfgbuffer[i] = (byte)strtol(buffer, &pEnd, 16);
+  // EEPROM.put() only writes changed bytes
+  log.crc = CRC32::calculate((byte *)&log, offsetof(resetLog_t, crc));
+  EEPROM.put(RESET_LOG_START, log);
 
-    // Add bytes to crc calculation
-    if (i < CFG_SIZE)
-    {
-      // Add hex chars from buffer without null-terminator
-      crc.update(buffer, 2);
-    }
-    else
-    {
-      // Store checksum from serial input
-      // later compare
-      crc_data <<= 8;
-      crc_data |= cfgbuffer[i];
-    }
+  trace(TRACE_BOOT, resetFlags);
+}
 
-    // Pad to 8 bit
-    // Add zero prefix to serial output
-    cfgbuffer[i] &= 0xff;
-    if (cfgbuffer[i] < 16)
-      Serial.write(48); // 0
+// Write the flags of the last reset and the resets per cause into the reset block.
+// Returns the length of the block.
+uint8_t writeResets(byte *buffer)
+{
+  uint16_t count[RESET_NUM];
+  uint8_t len = 0;
 
-    Serial.print(cfgbuffer[i], HEX);
-    Serial.print(" ");
+  EEPROM.get(RESET_LOG_START + offsetof(resetLog_t, count), count);
+  buffer[len++] = resetFlags;
+  for (uint8_t i = 0; i < RESET_NUM; i++)
+  {
+    buffer[len++] = count[i] >> 8;
+    buffer[len++] = count[i];
   }
+  return len;
+}
 
-  Serial.println();
+// Called from ISR. Returns false if the edge was ignored by the debounce.
+boolean queueEvent(uint8_t pin)
+{
+  uint32_t now = millis() + sleptMs;
 
-  Serial.print(F("> CHECKSUM (Serial Input): 0x"));
+  if (now - lastEdgeTime[pin] < EVENT_DEBOUNCE_MS)
+  {
+    return false;
+  }
+  lastEdgeTime[pin] = now;
+
+  // Overwrite the oldest event if the queue is full
+  if (eventLen == EVENT_QUEUE_SIZE)
+  {
+    eventHead = (eventHead + 1) % EVENT_QUEUE_SIZE;
+    eventLen--;
+    eventsDropped = true;
+  }
+
+  uint8_t i = (eventHead + eventLen) % EVENT_QUEUE_SIZE;
+  eventQueue[i].time = now;
+  eventQueue[i].pin = pin;
+  eventLen++;
+
+#ifdef LOG_DEBUG
+  isrMicros = micros();
+#endif
+  return true;
+}
+
+void wakeUp0()
+{
+  if (queueEvent(0))
+  {
+    wakedFromISR0 = true;
+  }
+}
+
+void wakeUp1()
+{
+  if (queueEvent(1))
+  {
+    wakedFromISR1 = true;
+  }
+}
+
+// Keep it tiny, this runs on every pulse during power down
+ISR(PCINT2_vect)
+{
+  uint8_t pins = PIND;
+  uint8_t falling = pulsePins & ~pins;
+  pulsePins = pins;
+
+  if (falling & bit(PULSE_PIN0))
+  {
+    pulseCount[0]++;
+  }
+  if (falling & bit(PULSE_PIN1))
+  {
+    pulseCount[1]++;
+  }
+}
+
+void setupPulseCounters()
+{
+  const uint8_t pins[PULSE_COUNTER_NUM] = {PULSE_PIN0, PULSE_PIN1};
+
+  for (uint8_t i = 0; i < PULSE_COUNTER_NUM; i++)
+  {
+    if (cfg.PULSE_COUNTERS & bit(i))
+    {
+      pinMode(pins[i], INPUT_PULLUP);
+    }
+  }
+  pulsePins = PIND;
+
+  for (uint8_t i = 0; i < PULSE_COUNTER_NUM; i++)
+  {
+    if (cfg.PULSE_COUNTERS & bit(i))
+    {
+      *digitalPinToPCMSK(pins[i]) |= bit(digitalPinToPCMSKbit(pins[i]));
+      *digitalPinToPCICR(pins[i]) |= bit(digitalPinToPCICRbit(pins[i]));
+    }
+  }
+}
+
+// Write the pulse counter deltas since the last uplink into the pulse block.
+// Deltas above 16 bit are carried over to the next uplink. Returns the length of the block.
+uint8_t writePulseDeltas(byte *buffer)
+{
+  uint8_t len = 1;
+
+  buffer[0] = cfg.PULSE_COUNTERS;
+  for (uint8_t i = 0; i < PULSE_COUNTER_NUM; i++)
+  {
+    if (cfg.PULSE_COUNTERS & bit(i))
+    {
+      noInterrupts();
+      uint32_t delta = pulseCount[i] - pulseReported[i];
+      interrupts();
+
+      delta = min(delta, 0xFFFF);
+      pulseReported[i] += delta;
+      buffer[len++] = delta >> 8;
+      buffer[len++] = delta;
+    }
+  }
+
+  return len;
+}
+
+boolean eventsQueued()
+{
+  return eventLen > 0;
+}
+
+// Sensor profile of the next uplink, depending on the queued pin events
+uint8_t sensorProfile()
+{
+  uint8_t profile = 0;
+  boolean queued = false;
+
+  noInterrupts();
+  for (uint8_t i = 0; i < eventLen; i++)
+  {
+    profile |= eventQueue[(eventHead + i) % EVENT_QUEUE_SIZE].pin == 0 ? cfg.SENSORS_ITR0 : cfg.SENSORS_ITR1;
+    queued = true;
+  }
+  interrupts();
+
+  return queued ? profile : cfg.SENSORS_PERIODIC;
+}
+
+// The first queued event waited the coalescing window for further events
+boolean eventWindowElapsed()
+{
+  uint32_t first;
+  noInterrupts();
+  first = eventQueue[eventHead].time;
+  interrupts();
+  return nodeTime() - first >= cfg.EVENT_COALESCE * 1000UL;
+}
+
+// Move the queued events into the events block of a payload and
+// update pinState with the last event. Returns the length of the block.
+uint8_t drainEvents(byte *buffer)
+{
+  uint8_t n = 0;
+  uint32_t now = nodeTime();
+
+  noInterrupts();
+  while (eventLen > 0)
+  {
+    pinEvent_t event;
+    event.time = eventQueue[eventHead].time;
+    event.pin = eventQueue[eventHead].pin;
+    eventHead = (eventHead + 1) % EVENT_QUEUE_SIZE;
+    eventLen--;
+    interrupts();
+
+    // Age in 0.1 s, bit 15 holds the pin
+    uint32_t age = (now - event.time) / 100;
+    uint16_t value = min(age, EVENT_MAX_AGE) | ((uint16_t)event.pin << 15);
+    buffer[1 + n * 2] = value >> 8;
+    buffer[2 + n * 2] = value;
+    n++;
+
+    if (event.pin == 0)
+    {
+      pinState |= STATE_ITR0;    // set bit in pinState byte to 1
+      pinState &= ~(STATE_ITR1); // set bit in pinState byte to 0
+    }
+    else
+    {
+      pinState |= STATE_ITR1;    // set bit in pinState byte to 1
+      pinState &= ~(STATE_ITR0); // set bit in pinState byte to 0
+    }
+
+    // set STATE_ITR_EVT bit in pinState byte to 1
+    // this means this pin was set now
+    pinState |= STATE_ITR_TRIGGER;
+
+    noInterrupts();
+  }
+
+  // Bit 7 of the count signals lost events
+  buffer[0] = n | (eventsDropped ? 0x80 : 0);
+  eventsDropped = false;
+  interrupts();
+
+  return 1 + n * 2;
+}
+
+// Peripherals never used: Timer1 and Timer2, the USART in release builds
+#if defined(LOG_DEBUG) || defined(CONFIG_MODE)
+#define PRR_UNUSED (bit(PRTIM1) | bit(PRTIM2))
+#else
+#define PRR_UNUSED (bit(PRTIM1) | bit(PRTIM2) | bit(PRUSART0))
+#endif
+
+// Power Reduction Register of each phase, a set bit stops the clock of a peripheral.
+// Timer0 keeps running for millis()/micros(), it stops anyway in power down.
+const uint8_t phasePRR[PHASE_NUM] = {
+    PRR_UNUSED | bit(PRSPI) | bit(PRTWI) | bit(PRADC), // PHASE_SLEEP
+    PRR_UNUSED | bit(PRTWI) | bit(PRADC),              // PHASE_AWAKE
+    PRR_UNUSED | bit(PRTWI),                           // PHASE_ADC
+    PRR_UNUSED | bit(PRADC),                           // PHASE_TWI
+    PRR_UNUSED | bit(PRTWI) | bit(PRADC),              // PHASE_ONEWIRE
+    PRR_UNUSED | bit(PRTWI) | bit(PRADC),              // PHASE_ENCODE
+};
+
+// Estimated current in µA of each power phase (MCU and sensors, radio in sleep or
+// standby) and of the radio on top of it, for the charge in the diagnostics frame.
+// Measure the currents of a board with PHASE_MARKER_PIN and adjust them.
+// tools/battery_life.py reads this table, keep one value and name per line.
+const uint16_t timeCurrent[TIME_NUM] PROGMEM = {
+    5,     // PHASE_SLEEP: Power down, watchdog and sensors in standby
+    3500,  // PHASE_AWAKE: ATmega328P at 8 MHz
+    3800,  // PHASE_ADC: ADC and voltage divider
+    4200,  // PHASE_TWI: BME280 measuring
+    5000,  // PHASE_ONEWIRE: DS18x converting
+    3500,  // PHASE_ENCODE
+    44000, // TIME_TX: SX1276 sending with 14 dBm (PA_BOOST)
+    400,   // TIME_RX: Mean over the receive windows, the radio listens only a part of them
+};
+
+// Adds the time since the last call to the current power phase.
+// The time in power down is counted by sleptMs, the LMIC clock stops.
+void phaseTimeAdd()
+{
+  ostime_t now = os_getTime();
+  if (powerPhaseNow != PHASE_SLEEP && powerPhaseNow < PHASE_NUM)
+  {
+    cycleTicks[powerPhaseNow] += now - phaseSince;
+  }
+  phaseSince = now;
+}
+
+// Switch to a power phase. Returns the previous phase, to restore it afterwards.
+uint8_t powerPhase(uint8_t phase)
+{
+  uint8_t prev = powerPhaseNow;
+  uint8_t prr = phasePRR[phase];
+
+  if (phase == prev)
+  {
+    return prev;
+  }
+
+  phaseTimeAdd();
+
+  // The ADC must be disabled before its clock is stopped,
+  // the TWI must be initialised again after its clock was stopped
+  if (prr & bit(PRADC))
+  {
+    ADCSRA &= ~bit(ADEN);
+  }
+  if ((prr & bit(PRTWI)) && !(PRR & bit(PRTWI)))
+  {
+    Wire.end();
+  }
+
+  // The SPI is initialised again by LMIC with every transfer
+  PRR = prr;
+
+  if (!(prr & bit(PRADC)))
+  {
+    ADCSRA |= bit(ADEN);
+  }
+  if (!(prr & bit(PRTWI)))
+  {
+    Wire.begin();
+  }
+
+  powerPhaseNow = phase;
+
+#ifdef PHASE_MARKER_PIN
+  digitalWrite(PHASE_MARKER_PIN, !digitalRead(PHASE_MARKER_PIN));
+#endif
+
+  return prev;
+}
+
+// Returns the battery voltage in mV
+uint16_t readBat()
+{
+  uint16_t value = 0;
+  uint8_t numReadings = 5;
+  uint8_t phase = powerPhase(PHASE_ADC);
+
+  for (uint8_t i = 0; i < numReadings; i++)
+  {
+    value = value + analogRead(BAT_SENSE_PIN);
+
+    // 1ms pause adds more stability between reads.
+    delay(1);
+  }
+
+  value = value / numReadings;
+  powerPhase(phase);
+
+  uint16_t batteryMV = (uint32_t)value * cfg.BAT_SENSE_UVPB / 1000;
+  if (CONFIG_MODE_ENABLED)
+  {
+    Serial.print(F("Analoge voltage: "));
+    Serial.print((uint32_t)value * 1100 / 1024);
+    Serial.print(F(" mV | Analoge value: "));
+    Serial.print(value);
+    Serial.print(F(" ("));
+    Serial.print((uint32_t)value * 100 / 1023);
+    Serial.print(F("% of Range) | Battery voltage: "));
+    Serial.print(batteryMV);
+    Serial.print(F(" mV (uVPB="));
+    Serial.print(cfg.BAT_SENSE_UVPB);
+    Serial.println(F(")"));
+  }
+
+  return batteryMV;
+}
+
+// FNV-1a hash over DEVEUI and DEVADDR. Stable per node, but different
+// between nodes running the same firmware.
+uint32_t nodeHash()
+{
+  uint32_t hash = 2166136261UL;
+  u1_t id[sizeof(((configData_t *)0)->DEVEUI) + sizeof(((configData_t *)0)->DEVADDR)];
+
+  readConfigKey(CFG_KEY(DEVEUI), id);
+  readConfigKey(CFG_KEY(DEVADDR), &id[sizeof(((configData_t *)0)->DEVEUI)]);
+  for (uint8_t i = 0; i < sizeof(id); i++)
+  {
+    hash ^= id[i];
+    hash *= 16777619UL;
+  }
+
+  return hash;
+}
+
+// Seed the send delay. rand() is never seeded by default, so all nodes
+// with the same firmware would draw the same delays after power up.
+void seedSendDelay()
+{
+  uint32_t seed = nodeHash();
+
+  // Mix in the noise of the least significant ADC bits
+  uint8_t phase = powerPhase(PHASE_ADC);
+  for (uint8_t i = 0; i < SEED_ADC_READINGS; i++)
+  {
+    seed = (seed << 1 | seed >> 31) ^ analogRead(BAT_SENSE_PIN);
+  }
+  powerPhase(phase);
+  randomSeed(seed);
+
+  // The slot is stable within the sleep time, so nodes powered up
+  // together spread over the whole send interval
+  if (cfg.TX_SLOTTED == 1 && cfg.SLEEPTIME > 0)
+  {
+    slotOffset = nodeHash() % cfg.SLEEPTIME;
+  }
+}
+
+// Print a value in 1/100 units with 2 decimals
+void printCenti(int32_t value)
+{
+  if (value < 0)
+  {
+    Serial.print('-');
+    value = -value;
+  }
+  Serial.print(value / 100);
+  Serial.print('.');
+  if (value % 100 < 10)
+    Serial.write(48); // 0
+  Serial.print(value % 100);
+}
+
+void printHex(byte buffer[], size_t arraySize)
+{
+  unsigned c;
+  for (size_t i = 0; i < arraySize; i++)
+  {
+    c = buffer[i];
+
+    if (i != 0)
+      Serial.write(32); // Space
+
+    c &= 0xff;
+    if (c < 16)
+      Serial.write(48); // 0
+    Serial.print(c, HEX);
+  }
+}
+
+// Max. application payload at the current data rate
+uint8_t maxPayload()
+{
+#if defined(CFG_eu868)
+  // DR0-DR7 (SF12 ... SF7/250kHz, FSK)
+  const uint8_t maxLen[] = {51, 51, 51, 115, 222, 222, 222, 222};
+  return LMIC.datarate < sizeof(maxLen) ? maxLen[LMIC.datarate] : maxLen[0];
+#else
+  // Smallest payload of all regions (US915 DR0)
+  return 11;
+#endif
+}
+
+uint16_t backlogAddr(uint8_t slot)
+{
+  return BACKLOG_START + sizeof(uint32_t) + slot * sizeof(backlogRecord_t);
+}
+
+// Restore the backlog ring after a reset. The samples are written to
+// consecutive slots with consecutive sequence numbers.
+void backlogInit()
+{
+  backlogRecord_t record;
+  uint16_t prevSeq = BACKLOG_EMPTY;
+
+  EEPROM.get(BACKLOG_START, backlogWear);
+  if (backlogWear == 0xFFFFFFFF)
+  {
+    backlogWear = 0; // Never written
+  }
+
+  backlogLen = 0;
+  for (uint8_t i = 0; i < BACKLOG_SLOTS; i++)
+  {
+    EEPROM.get(backlogAddr(i), record.seq);
+    if (record.seq == BACKLOG_EMPTY)
+    {
+      prevSeq = BACKLOG_EMPTY;
+      continue;
+    }
+
+    // Start of a run of consecutive samples
+    if (prevSeq == BACKLOG_EMPTY || record.seq != (uint16_t)(prevSeq + 1))
+    {
+      backlogHead = i;
+    }
+    prevSeq = record.seq;
+    backlogLen++;
+  }
+
+  // The run may wrap around the end of the ring
+  if (backlogLen > 0 && backlogHead + backlogLen > BACKLOG_SLOTS)
+  {
+    uint16_t firstSeq;
+    EEPROM.get(backlogAddr(0), firstSeq);
+    EEPROM.get(backlogAddr(BACKLOG_SLOTS - 1), record.seq);
+    if (firstSeq != (uint16_t)(record.seq + 1))
+    {
+      backlogHead = 0; // No wrap, the head found last is wrong
+    }
+  }
+
+  if (backlogLen > 0)
+  {
+    // Continue the node time of the newest sample, so the ages stay monotonic
+    EEPROM.get(backlogAddr((backlogHead + backlogLen - 1) % BACKLOG_SLOTS), record);
+    backlogSeq = record.seq + 1;
+    sleptMs = record.sample.time * 1000UL;
+  }
+}
+
+void backlogPush(const sample_t &sample)
+{
+  if (backlogWear >= BACKLOG_MAX_WEAR)
+  {
+    return; // EEPROM worn out
+  }
+
+  // Drop the oldest sample if the ring is full
+  if (backlogLen == BACKLOG_SLOTS)
+  {
+    backlogHead = (backlogHead + 1) % BACKLOG_SLOTS;
+    backlogLen--;
+  }
+
+  uint8_t slot = (backlogHead + backlogLen) % BACKLOG_SLOTS;
+  if (slot == 0)
+  {
+    // One write cycle per slot and lap
+    EEPROM.put(BACKLOG_START, ++backlogWear);
+  }
+
+  backlogRecord_t record;
+  record.seq = backlogSeq++;
+  if (backlogSeq == BACKLOG_EMPTY)
+  {
+    backlogSeq = 0;
+  }
+  record.sample = sample;
+  EEPROM.put(backlogAddr(slot), record);
+  backlogLen++;
+
+  log_e(LOG_BACKLOG_PUSH, backlogLen);
+}
+
+// Remove the oldest samples after they were acknowledged
+void backlogPop(uint8_t n)
+{
+  for (; n > 0 && backlogLen > 0; n--)
+  {
+    EEPROM.put(backlogAddr(backlogHead), (uint16_t)BACKLOG_EMPTY);
+    backlogHead = (backlogHead + 1) % BACKLOG_SLOTS;
+    backlogLen--;
+  }
+}
+
+// Convert a positive IEEE 754 float to an integer scaled by scale without
+// the soft-float library. The mantissa is cut, so the product fits into 32 bits.
+uint32_t floatToScaled(uint32_t bits, uint32_t scale)
+{
+  uint32_t mantissa = (bits & 0x7FFFFF) | 0x800000;
+  int16_t exp = (int16_t)((bits >> 23) & 0xFF) - 127 - 23;
+
+  if ((bits & 0x7FFFFFFF) == 0 || (bits >> 31))
+  {
+    return 0;
+  }
+  while (mantissa > 0xFFFFFFFF / scale)
+  {
+    mantissa >>= 1;
+    exp++;
+  }
+
+  uint32_t value = mantissa * scale;
+  if (exp >= 0)
+  {
+    return value << exp;
+  }
+  if (exp <= -32)
+  {
+    return 0;
+  }
+  return ((value >> (-exp - 1)) + 1) >> 1; // Rounded
+}
+
+// Read a key field of configData_t from EEPROM, e.g. readConfigKey(CFG_KEY(APPKEY), buf)
+void readConfigKey(uint8_t offset, uint8_t size, void *buf)
+{
+  for (uint8_t i = 0; i < size; i++)
+  {
+    ((uint8_t *)buf)[i] = EEPROM.read(CFG_START + offset + i);
+  }
+}
+
+// Copy the config from EEPROM into 'cfg' (or back with write), skipping the keys
+void transferConfig(boolean write)
+{
+  uint8_t *p = (uint8_t *)&cfg;
+
+  for (uint8_t i = 0; i < CFG_SIZE; i++)
+  {
+    if (i >= CFG_KEYS_START && i < CFG_KEYS_END)
+    {
+      continue;
+    }
+    if (write)
+    {
+      EEPROM.update(CFG_START + i, *p++);
+    }
+    else
+    {
+      *p++ = EEPROM.read(CFG_START + i);
+    }
+  }
+}
+
+void readConfig()
+{
+  transferConfig(false);
+
+  // Configs of older versions hold the battery values as float (V/bit and V),
+  // they are converted in place. These configs end with the keys, the fields after
+  // them were never written (0xFF) and get the behaviour of the older versions.
+  if (cfg.CONFIG_IS_VALID == CONFIG_VALID_FLOAT)
+  {
+    cfg.BAT_SENSE_UVPB = floatToScaled(cfg.BAT_SENSE_UVPB, 1000000);
+    cfg.BAT_MIN_MV = floatToScaled(cfg.BAT_MIN_MV, 1000);
+    memset(&cfg.CONFIRM_EVERY_N, 0, sizeof(cfg) - offsetof(config_t, CONFIRM_EVERY_N));
+    cfg.CONFIRM_RETRIES = TXCONF_ATTEMPTS - 1; // LMIC default
+    cfg.SENSORS_PERIODIC = BLOCK_BAT | BLOCK_BME | BLOCK_DS;
+    cfg.SENSORS_ITR0 = BLOCK_BAT | BLOCK_BME | BLOCK_DS;
+    cfg.SENSORS_ITR1 = BLOCK_BAT | BLOCK_BME | BLOCK_DS;
+    cfg.CONFIG_IS_VALID = CONFIG_VALID;
+    transferConfig(true);
+  }
+}
+
+void setConfig()
+{
+  byte cfgbuffer[CFG_SIZE_WITH_CHECKSUM];
+  char buffer[3];
+  char *pEnd;
+  uint32_t crc_data = 0;
+  CRC32 crc;
+
+  for (uint8_t i = 0; i < CFG_SIZE_WITH_CHECKSUM; i++)
+  {
+    if (!Serial.readBytes(buffer, 2))
+    {
+      break;
+    }
+
+    // added null-terminator for strtol
+    buffer[2] = '\0';
+
+    // convert null-terminated char buffer with hex values to int
+    cfgbuffer[i] = (byte)strtol(buffer, &pEnd, 16);
+
+    // Add bytes to crc calculation
+    if (i < CFG_SIZE)
+    {
+      // Add hex chars from buffer without null-terminator
+      crc.update(buffer, 2);
+    }
+    else
+    {
+      // Store checksum from serial input
+      // later compare
+      crc_data <<= 8;
+      crc_data |= cfgbuffer[i];
+    }
+
+    // Pad to 8 bit
+    // Add zero prefix to serial output
+    cfgbuffer[i] &= 0xff;
+    if (cfgbuffer[i] < 16)
+      Serial.write(48); // 0
+
+    Serial.print(cfgbuffer[i], HEX);
+    Serial.print(" ");
+  }
+
+  Serial.println();
+
+  Serial.print(F("> CHECKSUM (Serial Input): 0x"));
   Serial.print(crc_data, HEX);
   Serial.println();
 
-  uint32_t crc_calculated = crc.finalize();
-  Serial.print(F("> CHECKSUM (Calculated):   0x"));
-  Serial.println(crc_calculated, HEX);
+  uint32_t crc_calculated = crc.finalize();
+  Serial.print(F("> CHECKSUM (Calculated):   0x"));
+  Serial.println(crc_calculated, HEX);
+
+  if (crc_data == crc_calculated)
+  {
+
+    Serial.println(F("> Checksum correct. Configuration saved!"));
+
+    for (uint8_t i = CFG_START; i < CFG_SIZE; i++)
+    {
+      EEPROM.write(i, (uint8_t)cfgbuffer[i]);
+    }
+
+    readConfig();
+  }
+  else
+  {
+    Serial.println(F("> INVALID CHECKSUM! Process aborted! "));
+  }
+}
+
+void showConfig(bool raw = false)
+{
+  Serial.print(F("> CONFIG_IS_VALID: "));
+  if (cfg.CONFIG_IS_VALID == CONFIG_VALID)
+  {
+    Serial.println(F("yes"));
+  }
+  else
+  {
+    Serial.println(F("no"));
+  }
+  Serial.print(F("> SLEEPTIME: "));
+  Serial.println(cfg.SLEEPTIME, DEC);
+  Serial.print(F("> BAT_SENSE_UVPB: "));
+  Serial.println(cfg.BAT_SENSE_UVPB, DEC);
+  Serial.print(F("> BAT_MIN_MV: "));
+  Serial.println(cfg.BAT_MIN_MV, DEC);
+  Serial.print(F("> WAKEUP_BY_INTERRUPT_PINS: "));
+  switch (cfg.WAKEUP_BY_INTERRUPT_PINS)
+  {
+  case 0:
+    Serial.println(F("Disabled"));
+    break;
+  case 1:
+    Serial.println(F("Enabled"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+  Serial.print(F("> CONFIRMED_DATA_UP: "));
+  switch (cfg.CONFIRMED_DATA_UP)
+  {
+  case 0:
+    Serial.println(F("Unconfirmed Data Up"));
+    break;
+  case 1:
+    Serial.println(F("Confirmed Data Up"));
+    break;
+  case 2:
+    Serial.println(F("Adaptive"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+  Serial.print(F("> ACTIVATION_METHOD: "));
+  switch (cfg.ACTIVATION_METHOD)
+  {
+  case 1:
+    Serial.println(F("OTAA"));
+    break;
+  case 2:
+    Serial.println(F("ABP"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+  u1_t key[16];
+  u4_t devaddr;
+  Serial.print(F("> NWKSKEY (MSB): "));
+  readConfigKey(CFG_KEY(NWKSKEY), key);
+  printHex(key, 16);
+  Serial.print(F("\n> APPSKEY (MSB): "));
+  readConfigKey(CFG_KEY(APPSKEY), key);
+  printHex(key, 16);
+  Serial.print(F("\n> DEVADDR (MSB): "));
+  readConfigKey(CFG_KEY(DEVADDR), &devaddr);
+  Serial.print(devaddr, HEX);
+  Serial.print(F("\n> APPEUI (LSB): "));
+  readConfigKey(CFG_KEY(APPEUI), key);
+  printHex(key, 8);
+  Serial.print(F("\n> DEVEUI (LSB): "));
+  readConfigKey(CFG_KEY(DEVEUI), key);
+  printHex(key, 8);
+  Serial.print(F("\n> APPKEY (MSB): "));
+  readConfigKey(CFG_KEY(APPKEY), key);
+  printHex(key, 16);
+  Serial.print(F("\n> CONFIRM_EVERY_N: "));
+  Serial.print(cfg.CONFIRM_EVERY_N, DEC);
+  Serial.print(F("\n> CONFIRM_RETRIES: "));
+  Serial.print(cfg.CONFIRM_RETRIES, DEC);
+  Serial.print(F("\n> TX_SLOTTED: "));
+  switch (cfg.TX_SLOTTED)
+  {
+  case 0:
+    Serial.println(F("Random send delay"));
+    break;
+  case 1:
+    Serial.println(F("Fixed send slot"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+  Serial.print(F("> EVENT_FAST_PATH: "));
+  switch (cfg.EVENT_FAST_PATH)
+  {
+  case 0:
+    Serial.println(F("Disabled"));
+    break;
+  case 1:
+    Serial.println(F("Enabled"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+  Serial.print(F("> EVENT_COALESCE: "));
+  Serial.println(cfg.EVENT_COALESCE, DEC);
+  Serial.print(F("> PULSE_COUNTERS: "));
+  Serial.println(cfg.PULSE_COUNTERS, BIN);
+  Serial.print(F("> SENSORS_PERIODIC: "));
+  Serial.println(cfg.SENSORS_PERIODIC, BIN);
+  Serial.print(F("> SENSORS_ITR0: "));
+  Serial.println(cfg.SENSORS_ITR0, BIN);
+  Serial.print(F("> SENSORS_ITR1: "));
+  Serial.println(cfg.SENSORS_ITR1, BIN);
+  Serial.print(F("> BAT_INTERVAL: "));
+  Serial.println(cfg.BAT_INTERVAL, DEC);
+  Serial.print(F("> STATS_INTERVAL: "));
+  Serial.println(cfg.STATS_INTERVAL, DEC);
+  Serial.print(F("> DS_ALARM: "));
+  switch (cfg.DS_ALARM)
+  {
+  case 0:
+    Serial.println(F("Disabled"));
+    break;
+  case 1:
+    Serial.println(F("Enabled"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+  Serial.print(F("> DS_ALARM_HIGH: "));
+  Serial.println(cfg.DS_ALARM_HIGH, DEC);
+  Serial.print(F("> DS_ALARM_LOW: "));
+  Serial.println(cfg.DS_ALARM_LOW, DEC);
+  Serial.print(F("> ALARM_SLEEPTIME: "));
+  Serial.println(cfg.ALARM_SLEEPTIME, DEC);
+  Serial.print(F("> DIAG_INTERVAL: "));
+  Serial.println(cfg.DIAG_INTERVAL, DEC);
+  Serial.print(F("> BACKLOG: "));
+  switch (cfg.BACKLOG)
+  {
+  case 0:
+    Serial.println(F("Disabled"));
+    break;
+  case 1:
+    backlogInit();
+    Serial.print(F("Enabled ("));
+    Serial.print(backlogLen);
+    Serial.print(F(" samples, EEPROM wear "));
+    Serial.print(backlogWear);
+    Serial.println(F(" cycles)"));
+    break;
+  default:
+    Serial.println(F("Unkown"));
+    break;
+  }
+
+  if (raw)
+  {
+    Serial.print(F("> RAW ("));
+    Serial.print((uint32_t)CFG_SIZE, DEC);
+    Serial.print(F(" bytes): "));
+    byte c;
+    for (uint8_t i = CFG_START; i < CFG_SIZE; i++)
+    {
+      c = EEPROM.read(i);
+      c &= 0xff;
+      if (c < 16)
+        Serial.write(48); // 0
+      Serial.print(c, HEX);
+      Serial.print(" ");
+    }
+    Serial.println();
+  }
+}
+
+void eraseConfig()
+{
+  for (uint8_t i = CFG_START; i < CFG_SIZE; i++)
+  {
+    EEPROM.write(i, 0);
+  }
+}
 
-  if (crc_data == crc_calculated)
+void serialWait()
+{
+  while (!Serial.available())
   {
+    yield();
+    delay(50);
+  }
+}
 
-    Serial.println(F("> Checksum correct. Configuration saved!"));
+void showMemory()
+{
+#ifdef __AVR__
+  Serial.print(F("> Static RAM: "));
+  Serial.print((uint16_t)(&_end - (uint8_t *)RAMSTART), DEC);
+  Serial.print(F(" bytes\n> Free RAM now: "));
+  Serial.print((uint16_t)((uint8_t *)SP - &_end), DEC);
+  Serial.print(F(" bytes\n"));
+#endif
+  Serial.print(F("> Stack high-water mark: "));
+  Serial.print(stackFree(), DEC);
+  Serial.println(F(" bytes never used since boot"));
+}
 
-    for (uint8_t i = CFG_START; i < CFG_SIZE; i++)
+// Names of _TraceEvent
+const char traceNames[][8] PROGMEM = {"BOOT", "SLEEP", "WAKE", "BAT_LOW", "SENSORS", "QUEUED", "LMIC"};
+
+void showResets()
+{
+  resetLog_t log;
+
+  if (!readResetLog(log))
+  {
+    Serial.println(F("> No reset log"));
+    return;
+  }
+
+  Serial.print(F("> Last reset flags (MCUSR): "));
+  Serial.println(log.flags, BIN);
+  Serial.print(F("> Resets: power-on "));
+  Serial.print(log.count[RESET_POWER_ON], DEC);
+  Serial.print(F(", external "));
+  Serial.print(log.count[RESET_EXTERNAL], DEC);
+  Serial.print(F(", brown-out "));
+  Serial.print(log.count[RESET_BROWN_OUT], DEC);
+  Serial.print(F(", watchdog "));
+  Serial.print(log.count[RESET_WATCHDOG], DEC);
+  Serial.print(F(", other "));
+  Serial.println(log.count[RESET_OTHER], DEC);
+
+  Serial.println(F("> Trace before the last warm reset (oldest first):"));
+  if (log.traceLen == 0)
+  {
+    Serial.println(F("  none"));
+  }
+  for (uint8_t i = 0; i < min(log.traceLen, TRACE_SIZE); i++)
+  {
+    uint8_t event = log.trace[i].event;
+    Serial.print(F("  "));
+    if (event >= TRACE_BOOT && event <= TRACE_LMIC)
     {
-      EEPROM.write(i, (uint8_t)cfgbuffer[i]);
+      char c;
+      for (const char *p = traceNames[event - TRACE_BOOT]; (c = pgm_read_byte(p)) != '\0'; p++)
+      {
+        Serial.print(c);
+      }
+    }
+    else
+    {
+      Serial.print(event, DEC);
+    }
+    Serial.print(F(" "));
+    if (event == TRACE_BAT_LOW)
+    {
+      Serial.print(log.trace[i].arg * TRACE_BAT_MV, DEC);
+      Serial.println(F(" mV"));
     }
+    else
+    {
+      Serial.println(log.trace[i].arg, DEC);
+    }
+  }
+}
 
-    readConfig();
+void serialMenu()
+{
+  unsigned long timer = millis();
+
+  Serial.println(F("\n== CONFIG MENU =="));
+  Serial.println(F("[1] Show current config"));
+  Serial.println(F("[2] Set new config"));
+  Serial.println(F("[3] Erase current config"));
+  Serial.println(F("[4] Voltage calibration"));
+  Serial.println(F("[5] Memory usage"));
+  Serial.println(F("[6] Reset log"));
+  Serial.print(F("Select: "));
+  serialWait();
+
+  if (Serial.available() > 0)
+  {
+    switch (Serial.read())
+    {
+    case '1':
+      Serial.println(F("\n\n== SHOW CONFIG =="));
+      showConfig(true);
+      break;
+
+    case '2':
+      Serial.println(F("\n\n== SET CONFIG =="));
+      Serial.print(F("Past new config: "));
+      serialWait();
+      if (Serial.available() > 0)
+      {
+        setConfig();
+      }
+      break;
+
+    case '3':
+      Serial.println(F("\n\n== ERASE CONFIG =="));
+      Serial.print(F("Are you sure you want to erase the EEPROM? [y]es or [n]o: "));
+      serialWait();
+      Serial.println();
+      if (Serial.available() > 0)
+      {
+        if (Serial.read() == 'y')
+        {
+          eraseConfig();
+          Serial.println(F("Successfull!"));
+          readConfig();
+        }
+        else
+        {
+          Serial.println(F("Aborted!"));
+        }
+      }
+      break;
+
+    case '4':
+      Serial.println(F("\n\n== VOLTAGE CALIBRATION =="));
+      while (!Serial.available())
+      {
+        if (millis() - timer > VOL_DEBUG_INTERVAL)
+        {
+          readBat();
+          timer = millis();
+        }
+      }
+
+      break;
+
+    case '5':
+      Serial.println(F("\n\n== MEMORY USAGE =="));
+      showMemory();
+      break;
+
+    case '6':
+      Serial.println(F("\n\n== RESET LOG =="));
+      showResets();
+      break;
+    }
   }
-  else
+  clearSerialBuffer();
+}
+
+// Count down the backoff period of a failing sensor.
+// Returns true if the sensor is skipped in this readout.
+boolean sensorSkipped(uint8_t sensor)
+{
+  if (health[sensor].backoff > 0)
   {
-    Serial.println(F("> INVALID CHECKSUM! Process aborted! "));
+    health[sensor].backoff--;
+    return true;
   }
+  return false;
 }
 
-void showConfig(bool raw = false)
+// Update the health of a sensor after a readout. After SENSOR_MAX_FAILS
+// failed readouts in a row, the sensor is skipped for a backoff period,
+// which doubles with each further failure. Returns ok.
+boolean sensorResult(uint8_t sensor, boolean ok)
 {
-  Serial.print(F("> CONFIG_IS_VALID: "));
-  if (cfg.CONFIG_IS_VALID == 1)
+  if (ok)
   {
-    Serial.println(F("yes"));
+    health[sensor].fails = 0;
+    return true;
+  }
+
+  if (health[sensor].fails < 0x7F)
+  {
+    health[sensor].fails++;
+  }
+  if (health[sensor].fails >= SENSOR_MAX_FAILS)
+  {
+    health[sensor].backoff = 1 << min(health[sensor].fails - SENSOR_MAX_FAILS, SENSOR_MAX_BACKOFF);
+  }
+
+  log_e(LOG_SENSOR_FAILED, sensor);
+
+  return false;
+}
+
+boolean sensorsHealthy()
+{
+  for (uint8_t i = 0; i < SENSOR_NUM; i++)
+  {
+    if (health[i].fails > 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Write the status block: One byte per sensor (see _Sensor), bits 0-6 hold
+// the failed readouts in a row, bit 7 is set during the backoff period.
+// Returns the length of the block.
+uint8_t writeStatus(byte *buffer)
+{
+  for (uint8_t i = 0; i < SENSOR_NUM; i++)
+  {
+    buffer[i] = health[i].fails | (health[i].backoff > 0 ? 0x80 : 0);
+  }
+
+  return SENSOR_NUM;
+}
+
+// Program the alarm temperatures of all DS18x probes
+void setupAlarms()
+{
+  for (uint8_t i = 0; i < dsCount; i++)
+  {
+    if (!ds.setAlarms(dsSensors[i], cfg.DS_ALARM_HIGH, cfg.DS_ALARM_LOW))
+    {
+      log_e(LOG_DS_ALARM_FAILED, i);
+    }
+  }
+}
+
+// Find the probes in alarm after a conversion with the conditional search
+// and read only their temperatures
+void readAlarms()
+{
+  DeviceAddress deviceAddress;
+
+  dsAlarms = 0;
+  ds.resetAlarmSearch();
+  while (ds.alarmSearch(deviceAddress))
+  {
+    for (uint8_t i = 0; i < dsCount; i++)
+    {
+      if (memcmp(deviceAddress, dsSensors[i], sizeof(DeviceAddress)) == 0)
+      {
+        dsTemps[i] = ds.getTemp100(dsSensors[i]);
+        dsAlarms |= bit(i);
+        break;
+      }
+    }
+  }
+}
+
+// Write the alarm block: Bit mask of the probes in alarm, followed by their
+// temperatures. Returns the length of the block.
+uint8_t writeAlarms(byte *buffer)
+{
+  uint8_t len = 1;
+
+  buffer[0] = dsAlarms;
+  for (uint8_t i = 0; i < dsCount; i++)
+  {
+    if (dsAlarms & bit(i))
+    {
+      buffer[len++] = dsTemps[i] >> 8;
+      buffer[len++] = dsTemps[i];
+    }
+  }
+
+  return len;
+}
+
+// Read the BME280 into the sample. Returns true if the readout is valid and within its budget.
+boolean readBme(sample_t &sample)
+{
+  uint8_t phase = powerPhase(PHASE_TWI);
+  uint32_t start = millis();
+  boolean ok = bme.takeForcedMeasurement(BME_BUDGET_MS);
+
+  // Signed 16 bits integer, -32,768 up to +32,767
+  sample.temp1 = bme.readTemperature100();
+  // Unsigned 16 bits integer, 0 up to 65,535
+  sample.humi1 = bme.readHumidity100();
+  sample.press1 = bme.readPressurePa() / 100; // p [300..1100]
+  powerPhase(phase);
+
+  ok = ok && sample.temp1 != BME280_TEMP_INVALID && millis() - start <= BME_BUDGET_MS;
+#if defined(WIRE_HAS_TIMEOUT)
+  if (Wire.getWireTimeoutFlag())
+  {
+    ok = false;
+    Wire.clearWireTimeoutFlag();
+  }
+#endif
+  return ok;
+}
+
+// Read the DS18x probes into dsTemps after one shared conversion. With all false
+// (or with alarms) only the first probe is read, with alarms also the probes in alarm.
+// Returns true if the first probe is valid and the readout within its budget.
+boolean readDs(boolean all)
+{
+  uint8_t phase = powerPhase(PHASE_ONEWIRE);
+  uint32_t start = millis();
+
+  // Starts the conversion on all sensors (SKIP ROM),
+  // without presence pulse the bus is shorted or open
+  boolean ok = ds.requestTemperatures();
+  if (ok && (!all || cfg.DS_ALARM == 1))
+  {
+    // Only the measurement sensor and the probes in alarm are read
+    dsTemps[0] = ds.getTemp100(dsSensors[0]);
+    if (all)
+    {
+      readAlarms();
+    }
   }
   else
   {
-    Serial.println(F("no"));
+    for (uint8_t i = 0; i < dsCount; i++)
+    {
+      // Probes beyond the budget are reported as disconnected
+      boolean inBudget = ok && millis() - start <= DS_BUDGET_MS;
+      dsTemps[i] = inBudget ? ds.getTemp100(dsSensors[i]) : DEVICE_DISCONNECTED_C100;
+    }
   }
-  Serial.print(F("> SLEEPTIME: "));
-  Serial.println(cfg.SLEEPTIME, DEC);
-  Serial.print(F("> BAT_SENSE_VPB: "));
-  Serial.println(cfg.BAT_SENSE_VPB, DEC);
-  Serial.print(F("> BAT_MIN_VOLTAGE: "));
-  Serial.println(cfg.BAT_MIN_VOLTAGE, DEC);
-  Serial.print(F("> WAKEUP_BY_INTERRUPT_PINS: "));
-  switch (cfg.WAKEUP_BY_INTERRUPT_PINS)
+
+  ok = ok && dsTemps[0] != DEVICE_DISCONNECTED_C100 && millis() - start <= DS_BUDGET_MS;
+  powerPhase(phase);
+  return ok;
+}
+
+// Read the sensors of the profile into a sample
+void readSample(sample_t &sample, uint8_t profile)
+{
+  sample.time = nodeTime() / 1000;
+  sample.content = 0;
+  trace(TRACE_SENSORS, profile);
+
+  // Battery, slow changing, so only every BAT_INTERVAL uplink
+  if ((profile & BLOCK_BAT) && ++uplinksSinceBat >= cfg.BAT_INTERVAL)
+  {
+    uplinksSinceBat = 0;
+
+    // Unsigned 16 bits integer, 0 up to 65,535, in 10 mV
+    sample.bat = readBat() / 10;
+    sample.content |= BLOCK_BAT;
+  }
+
+  // Read sensor values von BME280
+  // in 1/100 units to effectively keep 2 decimals
+  if ((profile & BLOCK_BME) && foundBME && !sensorSkipped(SENSOR_BME))
+  {
+    if (sensorResult(SENSOR_BME, readBme(sample)))
+    {
+      sample.content |= BLOCK_BME;
+    }
+  }
+
+  // Read sensor value form 1-Wire sensor
+  // in 1/100 degrees to effectively keep 2 decimals
+  if ((profile & BLOCK_DS) && foundDS && !sensorSkipped(SENSOR_DS))
+  {
+    if (sensorResult(SENSOR_DS, readDs(true)))
+    {
+      // The first sensor is the measurement sensor of the sample
+      sample.temp2 = dsTemps[0];
+      sample.content |= BLOCK_DS;
+    }
+  }
+}
+
+// Write the sensor blocks of a sample. The DS18x block holds the count and the
+// temperatures of the first probes sensors of the last readout, with DS_SINGLE
+// only the measurement sensor. Returns the length.
+uint8_t writeSample(byte *buffer, const sample_t &sample, uint8_t probes = DS_SINGLE)
+{
+  uint8_t len = 0;
+
+  if (sample.content & BLOCK_BAT)
+  {
+    buffer[len++] = sample.bat >> 8;
+    buffer[len++] = sample.bat;
+  }
+  if (sample.content & BLOCK_BME)
+  {
+    buffer[len++] = sample.temp1 >> 8;
+    buffer[len++] = sample.temp1;
+    buffer[len++] = sample.humi1 >> 8;
+    buffer[len++] = sample.humi1;
+    buffer[len++] = sample.press1 >> 8;
+    buffer[len++] = sample.press1;
+  }
+  if ((sample.content & BLOCK_DS) && probes == DS_SINGLE)
+  {
+    buffer[len++] = sample.temp2 >> 8;
+    buffer[len++] = sample.temp2;
+  }
+  else if (sample.content & BLOCK_DS)
+  {
+    buffer[len++] = probes;
+    for (uint8_t i = 0; i < probes; i++)
+    {
+      buffer[len++] = dsTemps[i] >> 8;
+      buffer[len++] = dsTemps[i];
+    }
+  }
+
+  return len;
+}
+
+void statsAddValue(stat_t &stat, int16_t value)
+{
+  if (statsCount == 0)
+  {
+    stat.min = stat.max = value;
+    stat.sum = 0;
+  }
+  stat.min = min(stat.min, value);
+  stat.max = max(stat.max, value);
+  stat.sum += value;
+}
+
+// Add the BME and DS18x values of a sample to the window statistics
+void statsAdd(const sample_t &sample)
+{
+  if (statsCount == 0xFF)
+  {
+    return;
+  }
+
+  // Only values present in every sample of the window are reported
+  uint8_t content = sample.content & (BLOCK_BME | BLOCK_DS);
+  statsContent = statsCount == 0 ? content : statsContent & content;
+
+  if (content & BLOCK_BME)
+  {
+    statsAddValue(stats[STAT_TEMP1], sample.temp1);
+    statsAddValue(stats[STAT_HUMI1], sample.humi1);
+    statsAddValue(stats[STAT_PRESS1], sample.press1);
+  }
+  if (content & BLOCK_DS)
+  {
+    statsAddValue(stats[STAT_TEMP2], sample.temp2);
+  }
+  statsCount++;
+}
+
+// Intermediate sample between two uplinks. Only the values of the statistics are read,
+// the sensor health, its backoff and the trace are left to the readouts of the uplinks.
+void statsSample()
+{
+  sample_t sample;
+
+  sample.content = 0;
+  if ((cfg.SENSORS_PERIODIC & BLOCK_BME) && foundBME && health[SENSOR_BME].backoff == 0 && readBme(sample))
+  {
+    sample.content |= BLOCK_BME;
+  }
+  if ((cfg.SENSORS_PERIODIC & BLOCK_DS) && foundDS && health[SENSOR_DS].backoff == 0 && readDs(false))
   {
-  case 0:
-    Serial.println(F("Disabled"));
-    break;
-  case 1:
-    Serial.println(F("Enabled"));
-    break;
-  default:
-    Serial.println(F("Unkown"));
-    break;
+    sample.temp2 = dsTemps[0];
+    sample.content |= BLOCK_DS;
   }
-  Serial.print(F("> CONFIRMED_DATA_UP: "));
-  switch (cfg.CONFIRMED_DATA_UP)
+  statsAdd(sample);
+}
+
+uint8_t writeStat(byte *buffer, const stat_t &stat)
+{
+  int16_t mean = stat.sum / statsCount;
+  buffer[0] = stat.min >> 8;
+  buffer[1] = stat.min;
+  buffer[2] = stat.max >> 8;
+  buffer[3] = stat.max;
+  buffer[4] = mean >> 8;
+  buffer[5] = mean;
+  return 6;
+}
+
+// Write the window statistics into the stats block and start a new window.
+// Returns the length of the block.
+uint8_t writeStats(byte *buffer)
+{
+  uint8_t len = 2;
+
+  buffer[0] = statsCount;
+  buffer[1] = statsContent;
+  if (statsContent & BLOCK_BME)
   {
-  case 0:
-    Serial.println(F("Unconfirmed Data Up"));
-    break;
-  case 1:
-    Serial.println(F("Confirmed Data Up"));
-    break;
-  default:
-    Serial.println(F("Unkown"));
-    break;
+    len += writeStat(&buffer[len], stats[STAT_TEMP1]);
+    len += writeStat(&buffer[len], stats[STAT_HUMI1]);
+    len += writeStat(&buffer[len], stats[STAT_PRESS1]);
   }
-  Serial.print(F("> ACTIVATION_METHOD: "));
-  switch (cfg.ACTIVATION_METHOD)
+  if (statsContent & BLOCK_DS)
   {
-  case 1:
-    Serial.println(F("OTAA"));
-    break;
-  case 2:
-    Serial.println(F("ABP"));
-    break;
-  default:
-    Serial.println(F("Unkown"));
-    break;
+    len += writeStat(&buffer[len], stats[STAT_TEMP2]);
   }
-  Serial.print(F("> NWKSKEY (MSB): "));
-  printHex(cfg.NWKSKEY, sizeof(cfg.NWKSKEY));
-  Serial.print(F("\n> APPSKEY (MSB): "));
-  printHex(cfg.APPSKEY, sizeof(cfg.APPSKEY));
-  Serial.print(F("\n> DEVADDR (MSB): "));
-  Serial.print(cfg.DEVADDR, HEX);
-  Serial.print(F("\n> APPEUI (LSB): "));
-  printHex(cfg.APPEUI, sizeof(cfg.APPEUI));
-  Serial.print(F("\n> DEVEUI (LSB): "));
-  printHex(cfg.DEVEUI, sizeof(cfg.DEVEUI));
-  Serial.print(F("\n> APPKEY (MSB): "));
-  printHex(cfg.APPKEY, sizeof(cfg.APPKEY));
-  Serial.println();
+  statsCount = 0;
 
-  if (raw)
+  return len;
+}
+
+// Decide if the next uplink should be confirmed
+boolean confirmUplink()
+{
+  switch (cfg.CONFIRMED_DATA_UP)
   {
-    Serial.print(F("> RAW ("));
-    Serial.print((uint32_t)sizeof(cfg), DEC);
-    Serial.print(F(" bytes): "));
-    byte c;
-    for (uint8_t i = CFG_START; i < sizeof(cfg); i++)
+  case CONFIRMED:
+    return true;
+
+  case CONFIRMED_ADAPTIVE:
+    // Always confirm interrupt triggered events (e.g. mailbox full)
+    if (pinState & STATE_ITR_TRIGGER)
     {
-      c = EEPROM.read(i);
-      c &= 0xff;
-      if (c < 16)
-        Serial.write(48); // 0
-      Serial.print(c, HEX);
-      Serial.print(" ");
+      return true;
     }
-    Serial.println();
+
+    // Confirm all uplinks during an outage to notice when the link is back
+    if (backlogLen > 0)
+    {
+      return true;
+    }
+
+    // Confirm every Nth periodic uplink
+    if (cfg.CONFIRM_EVERY_N > 0 && ++uplinksSinceConfirm >= cfg.CONFIRM_EVERY_N)
+    {
+      uplinksSinceConfirm = 0;
+      return true;
+    }
+    return false;
+
+  default:
+    return false;
   }
 }
 
-void eraseConfig()
+// Retransmissions of a confirmed uplink, derived from the link quality of the last ACK.
+// Without any ACK so far the configured maximum is used.
+uint8_t confirmRetries()
 {
-  for (uint8_t i = CFG_START; i < sizeof(cfg); i++)
+  uint8_t retries = min(cfg.CONFIRM_RETRIES, TXCONF_ATTEMPTS - 1);
+
+  if (cfg.CONFIRMED_DATA_UP == CONFIRMED_ADAPTIVE && ackReceived)
   {
-    EEPROM.write(i, 0);
+    if (lastAckSnr >= LINK_SNR_GOOD && lastAckRssi >= LINK_RSSI_GOOD)
+    {
+      retries = min(retries, 1);
+    }
+    else if (lastAckSnr >= LINK_SNR_MEDIUM)
+    {
+      retries = (retries + 1) / 2;
+    }
   }
+
+  return retries;
 }
 
-void serialWait()
+// Hand an uplink to LMIC, it is sent at the next possible time
+void queueUplink(uint8_t port, byte *buffer, uint8_t len, boolean confirmed)
 {
-  while (!Serial.available())
+  txPort = port;
+  txRetries = confirmed ? confirmRetries() : 0;
+  LMIC_setTxData2(port, buffer, len, confirmed);
+  trace(TRACE_QUEUED, txPort);
+}
+
+// Called at the start of every transmission. LMIC retransmits a confirmed uplink
+// without ACK until txCnt reaches TXCONF_ATTEMPTS. txCnt must not be set before the
+// frame is built: LMIC only counts up the frame counter for a frame built with txCnt 0
+// and the TX is often deferred (duty cycle, join). The frame is built before
+// EV_TXSTART, so the last allowed attempt ends the retransmissions here.
+void limitRetries()
+{
+  if (LMIC.pendTxConf && !(LMIC.opmode & OP_JOINING) && LMIC.txCnt >= txRetries)
   {
-    yield();
-    delay(50);
+    LMIC.txCnt = TXCONF_ATTEMPTS;
   }
 }
 
-void serialMenu()
+// Fit the blocks of a data uplink into the max. payload of the current data rate.
+// Pin events (worst case, the ISR may add some) and the alarm block are always sent.
+// The pulse deltas, the sensor status and the window statistics follow in this order,
+// each only if the first DS18x probe still fits. The statistics replace the BME280
+// block. A block left out is carried over to the next uplink. Returns the optional
+// blocks to send, the DS18x probes get the rest.
+uint8_t fitBlocks(uint8_t content, uint8_t &probes)
 {
-  unsigned long timer = millis();
-
-  Serial.println(F("\n== CONFIG MENU =="));
-  Serial.println(F("[1] Show current config"));
-  Serial.println(F("[2] Set new config"));
-  Serial.println(F("[3] Erase current config"));
-  Serial.println(F("[4] Voltage calibration"));
-  Serial.print(F("Select: "));
-  serialWait();
+  int16_t space = maxPayload() - 3;
+  int16_t first = 0; // Space of the first DS18x probe
+  uint8_t blocks = 0;
 
-  if (Serial.available() > 0)
+  if (content & BLOCK_BAT)
   {
-    switch (Serial.read())
+    space -= 2;
+  }
+  if (content & BLOCK_BME)
+  {
+    space -= 6;
+  }
+  if (content & BLOCK_DS)
+  {
+    space -= 1; // Number of probes
+    first = 2;
+    if (cfg.DS_ALARM == 1)
     {
-    case '1':
-      Serial.println(F("\n\n== SHOW CONFIG =="));
-      showConfig(true);
-      break;
-
-    case '2':
-      Serial.println(F("\n\n== SET CONFIG =="));
-      Serial.print(F("Past new config: "));
-      serialWait();
-      if (Serial.available() > 0)
-      {
-        setConfig();
-      }
-      break;
-
-    case '3':
-      Serial.println(F("\n\n== ERASE CONFIG =="));
-      Serial.print(F("Are you sure you want to erase the EEPROM? [y]es or [n]o: "));
-      serialWait();
-      Serial.println();
-      if (Serial.available() > 0)
-      {
-        if (Serial.read() == 'y')
-        {
-          eraseConfig();
-          Serial.println(F("Successfull!"));
-          readConfig();
-        }
-        else
-        {
-          Serial.println(F("Aborted!"));
-        }
-      }
-      break;
-
-    case '4':
-      Serial.println(F("\n\n== VOLTAGE CALIBRATION =="));
-      while (!Serial.available())
+      space -= 1;
+      for (uint8_t i = 0; i < dsCount; i++)
       {
-        if (millis() - timer > VOL_DEBUG_INTERVAL)
+        if (dsAlarms & bit(i))
         {
-          readBat();
-          timer = millis();
+          space -= 2;
         }
       }
+    }
+  }
+  if (eventsQueued())
+  {
+    space -= 1 + EVENT_QUEUE_SIZE * 2;
+  }
 
-      break;
+  if (cfg.PULSE_COUNTERS)
+  {
+    uint8_t size = 1 + ((cfg.PULSE_COUNTERS & 1) + ((cfg.PULSE_COUNTERS >> 1) & 1)) * 2;
+    if (space - size >= first)
+    {
+      blocks |= BLOCK_PULSE;
+      space -= size;
     }
   }
-  clearSerialBuffer();
+  if (!sensorsHealthy() && space - SENSOR_NUM >= first)
+  {
+    blocks |= BLOCK_STATUS;
+    space -= SENSOR_NUM;
+  }
+  if (statsContent)
+  {
+    int16_t size = 2 + (statsContent & BLOCK_BME ? 3 * 6 : 0) + (statsContent & BLOCK_DS ? 6 : 0);
+    if (content & statsContent & BLOCK_BME)
+    {
+      size -= 6;
+    }
+    if (space - size >= first)
+    {
+      blocks |= BLOCK_STATS;
+      space -= size;
+    }
+  }
+
+  // With alarms the other probes are only sent in the alarm block
+  probes = 0;
+  if ((content & BLOCK_DS) && space >= 2)
+  {
+    probes = min(space / 2, cfg.DS_ALARM == 1 ? 1 : dsCount);
+  }
+
+  return blocks;
 }
 
 void do_send(osjob_t *j)
@@ -504,54 +2402,76 @@ void do_send(osjob_t *j)
   }
   else
   {
-    // Unsigned 16 bits integer, 0 up to 65,535
-    uint16_t bat = 0;
+    byte buffer[3 + 2 + 6 + 1 + DS_MAX_SENSORS * 2 + 1 + EVENT_QUEUE_SIZE * 2 + 1 + PULSE_COUNTER_NUM * 2 + 2 + STAT_NUM * 6 + SENSOR_NUM + 1 + DS_MAX_SENSORS * 2];
+    uint8_t len = 3;
+    uint8_t phase = powerPhase(PHASE_ENCODE);
 
-    // Battery
-    bat = readBat() * 100;
+    // Skipped sensors cost neither bus time nor payload bytes
+    readSample(lastSample, sensorProfile());
 
-    // Signed 16 bits integer, -32,768 up to +32,767
-    int16_t temp1 = -127 * 100;
-    int16_t temp2 = -127 * 100;
+    // The window statistics include the sample of the uplink
+    if (cfg.STATS_INTERVAL > 0)
+    {
+      statsAdd(lastSample);
+      if (!statsContent)
+      {
+        statsCount = 0; // No value in every sample, start a new window
+      }
+    }
 
-    // Unsigned 16 bits integer, 0 up to 65,535
-    uint16_t humi1 = 0;
-    uint16_t press1 = 0;
+    uint8_t probes;
+    uint8_t blocks = fitBlocks(lastSample.content, probes);
 
-    // Read sensor values von BME280
-    // and multiply by 100 to effectively keep 2 decimals
-    if (foundBME)
+    // With the statistics only the summary of the window is sent, not the point values
+    // it covers. The DS18x block stays if it carries further probes.
+    sample_t point = lastSample;
+    if (blocks & BLOCK_STATS)
     {
-      bme.takeForcedMeasurement();
-      temp1 = bme.readTemperature() * 100;
-      humi1 = bme.readHumidity() * 100;
-      press1 = bme.readPressure() / 100.0F; // p [300..1100]
+      point.content &= ~(statsContent & (probes > 1 ? BLOCK_BME : BLOCK_BME | BLOCK_DS));
     }
+    byte content = point.content;
+    len += writeSample(&buffer[len], point, probes);
 
-    // Read sensor value form 1-Wire sensor
-    // and multiply by 100 to effectively keep 2 decimals
-    if (foundDS)
+    // Pin events, nothing is cancelled or lost if they arrive during a transmission
+    if (eventsQueued())
     {
-      ds.requestTemperatures(); // Send the command to get temperatures
-      temp2 = ds.getTempC(dsSensor) * 100;
+      content |= BLOCK_EVENTS;
+      len += drainEvents(&buffer[len]);
     }
 
-    byte buffer[12];
-    buffer[0] = pinState;
-    buffer[1] = bat >> 8;
-    buffer[2] = bat;
-    buffer[3] = (VERSION_MAJOR << 4) | (VERSION_MINOR & 0xf);
-    buffer[4] = temp1 >> 8;
-    buffer[5] = temp1;
-    buffer[6] = humi1 >> 8;
-    buffer[7] = humi1;
-    buffer[8] = press1 >> 8;
-    buffer[9] = press1;
-    buffer[10] = temp2 >> 8;
-    buffer[11] = temp2;
-
-    log_d("Prepare pck #");
-    log_d_ln(++prepareCount);
+    if (blocks & BLOCK_PULSE)
+    {
+      content |= BLOCK_PULSE;
+      len += writePulseDeltas(&buffer[len]);
+    }
+
+    // Summary of the samples taken between the uplinks. Without space
+    // in this uplink, the window continues until the next one.
+    if (blocks & BLOCK_STATS)
+    {
+      content |= BLOCK_STATS;
+      len += writeStats(&buffer[len]);
+    }
+
+    // Failing sensors, their blocks are missing
+    if (blocks & BLOCK_STATUS)
+    {
+      content |= BLOCK_STATUS;
+      len += writeStatus(&buffer[len]);
+    }
+
+    // Also sent without alarm, so the end of an alarm is reported
+    if (cfg.DS_ALARM == 1 && (lastSample.content & BLOCK_DS))
+    {
+      content |= BLOCK_DS_ALARM;
+      len += writeAlarms(&buffer[len]);
+    }
+
+    buffer[0] = pinState | STATE_BLOCKS;
+    buffer[1] = (VERSION_MAJOR << 4) | (VERSION_MINOR & 0xf);
+    buffer[2] = content;
+
+    log_e(LOG_PREPARE, ++prepareCount);
     // log_d(F("> FW: v"));
     // log_d(VERSION_MAJOR);
     // log_d(F("."));
@@ -568,18 +2488,229 @@ void do_send(osjob_t *j)
     // log_d_ln(press1);
     // log_d(F("> DS18x Temp: "));
     // log_d_ln(temp2);
-    log_d(F("> Payload: "));
-    logHex_d(buffer, sizeof(buffer));
-    log_d_ln();
+    powerPhase(phase);
+    log_e(LOG_PAYLOAD, logBytes(buffer, len));
+
+    // Print first debug messages in loop immediately
+    lastPrintTime = 0;
+
+    TXCompleted = false;
+
+    // Full telemetry starts a new send interval
+    sleepRemaining = 0;
+
+    // Prepare upstream data transmission at the next possible time.
+    // Only a missing ACK shows that a sample got lost, so the backlog needs confirmed uplinks.
+    boolean confirmed = confirmUplink() || cfg.BACKLOG == 1;
+    queueUplink(DATA_FPORT, buffer, len, confirmed);
+    log_e(LOG_QUEUED);
+  }
+}
+
+// Fast path for interrupts: Queue a minimal event frame without reading
+// any sensor. The full telemetry is sent with the next periodic uplink.
+void do_send_event(osjob_t *j)
+{
+  // Check if there is not a current TX/RX job running
+  if (LMIC.opmode & OP_TXRXPEND)
+  {
+    // Serial.println(F("OP_TXRXPEND, not sending"));
+  }
+  else
+  {
+    byte buffer[2 + 1 + EVENT_QUEUE_SIZE * 2];
+    uint8_t phase = powerPhase(PHASE_ENCODE);
+    uint8_t len = 2 + drainEvents(&buffer[2]);
+    buffer[0] = pinState;
+    buffer[1] = ++eventCount;
+    powerPhase(phase);
+
+    log_e(LOG_EVENT_FRAME, logBytes(buffer, len));
+
+    // Print first debug messages in loop immediately
+    lastPrintTime = 0;
+
+    TXCompleted = false;
+
+    // Prepare upstream data transmission at the next possible time.
+    queueUplink(EVENT_FPORT, buffer, len, confirmUplink());
+    log_e(LOG_EVENT_QUEUED);
+  }
+}
+
+// Catch-up frame with the oldest samples from the backlog. Always confirmed,
+// the samples are removed from the backlog after the ACK.
+void do_send_backlog(osjob_t *j)
+{
+  // Check if there is not a current TX/RX job running
+  if (LMIC.opmode & OP_TXRXPEND)
+  {
+    // Serial.println(F("OP_TXRXPEND, not sending"));
+  }
+  else
+  {
+    byte buffer[BACKLOG_MAX_FRAME];
+    uint8_t maxLen = min(maxPayload(), sizeof(buffer));
+    uint8_t len = 1;
+    uint32_t now = nodeTime() / 1000;
+    backlogRecord_t record;
+    uint8_t phase = powerPhase(PHASE_ENCODE);
+
+    // Age (3 bytes), content and sensor blocks per sample
+    for (backlogSent = 0; backlogSent < backlogLen; backlogSent++)
+    {
+      EEPROM.get(backlogAddr((backlogHead + backlogSent) % BACKLOG_SLOTS), record);
+
+      byte sample[4 + 2 + 6 + 2];
+      uint32_t age = min(now - record.sample.time, 0xFFFFFFUL);
+      sample[0] = age >> 16;
+      sample[1] = age >> 8;
+      sample[2] = age;
+      sample[3] = record.sample.content;
+      uint8_t sampleLen = 4 + writeSample(&sample[4], record.sample);
+
+      if (len + sampleLen > maxLen)
+      {
+        break;
+      }
+      memcpy(&buffer[len], sample, sampleLen);
+      len += sampleLen;
+    }
+    buffer[0] = backlogSent;
+    powerPhase(phase);
+
+    log_e(LOG_BACKLOG_FRAME, logBytes(buffer, len));
+
+    // Print first debug messages in loop immediately
+    lastPrintTime = 0;
+
+    TXCompleted = false;
+
+    queueUplink(BACKLOG_FPORT, buffer, len, true);
+    log_e(LOG_BACKLOG_QUEUED);
+  }
+}
+
+// End of a transmission: Adds its airtime and the receive windows after it.
+// LMIC sets txend when the radio finished sending.
+void radioTimeAdd()
+{
+  ostime_t now = os_getTime();
+  ostime_t tx = LMIC.txend - txStart;
+  ostime_t rx = now - LMIC.txend;
+
+  // A transmission canceled before the radio finished is not counted
+  if (!txTimed && tx > 0 && rx >= 0)
+  {
+    cycleTicks[TIME_TX] += tx;
+    cycleTicks[TIME_RX] += rx;
+  }
+  txTimed = true;
+}
+
+// End of a cycle with a data or event uplink: Moves the times of the cycle
+// to lastCycle and adds its estimated charge to the totals
+void cycleEnd()
+{
+  uint32_t slept;
+  uint32_t charge = 0;
+
+  noInterrupts();
+  slept = sleptMs - cycleSleptMs;
+  interrupts();
+  cycleSleptMs += slept;
+  phaseTimeAdd();
+
+  for (uint8_t i = 0; i < TIME_NUM; i++)
+  {
+    uint32_t ms = i == PHASE_SLEEP ? slept : osticks2ms(cycleTicks[i]);
+    uint16_t current = pgm_read_word(&timeCurrent[i]);
+
+    // µA * ms / 1000, split to not overflow on long times
+    charge += ms / 1000 * current + ms % 1000 * current / 1000;
+    lastCycle.time[i] = min(i == PHASE_SLEEP ? ms / 1000 : ms, 0xFFFFUL);
+    cycleTicks[i] = 0;
+  }
+  lastCycle.txAttempts = txAttempts;
+  lastCycle.charge = charge;
+  txAttempts = 0;
+
+  charge += chargeRest;
+  chargeTotal += charge / 1000;
+  chargeRest = charge % 1000;
+  cycleCount++;
+
+  log_e(LOG_CYCLE, lastCycle.charge, chargeTotal);
+}
+
+// Write the times and charge of the last cycle into the cycle block.
+// Returns the length of the block.
+uint8_t writeCycle(byte *buffer)
+{
+  uint8_t len = 0;
+
+  // Times of the phases (without PHASE_SLEEP) and the radio in ms
+  for (uint8_t i = PHASE_SLEEP + 1; i < TIME_NUM; i++)
+  {
+    buffer[len++] = lastCycle.time[i] >> 8;
+    buffer[len++] = lastCycle.time[i];
+  }
+  buffer[len++] = lastCycle.txAttempts;
+  buffer[len++] = lastCycle.time[PHASE_SLEEP] >> 8;
+  buffer[len++] = lastCycle.time[PHASE_SLEEP];
+  buffer[len++] = lastCycle.charge >> 24;
+  buffer[len++] = lastCycle.charge >> 16;
+  buffer[len++] = lastCycle.charge >> 8;
+  buffer[len++] = lastCycle.charge;
+  buffer[len++] = chargeTotal >> 24;
+  buffer[len++] = chargeTotal >> 16;
+  buffer[len++] = chargeTotal >> 8;
+  buffer[len++] = chargeTotal;
+  buffer[len++] = cycleCount >> 8;
+  buffer[len++] = cycleCount;
+  return len;
+}
+
+// Diagnostics frame with the health of the node, sent unconfirmed
+// after every DIAG_INTERVAL periodic uplink
+void do_send_diag(osjob_t *j)
+{
+  // Check if there is not a current TX/RX job running
+  if (LMIC.opmode & OP_TXRXPEND)
+  {
+    // Serial.println(F("OP_TXRXPEND, not sending"));
+  }
+  else
+  {
+    byte buffer[2 + 2 + 27 + 11];
+    uint8_t phase = powerPhase(PHASE_ENCODE);
+    uint8_t len = 2;
+    uint16_t stack = stackFree();
+
+    buffer[0] = (VERSION_MAJOR << 4) | (VERSION_MINOR & 0xf);
+    buffer[1] = DIAG_STACK;
+    buffer[len++] = stack >> 8;
+    buffer[len++] = stack;
+
+    if (cycleCount > 0)
+    {
+      buffer[1] |= DIAG_CYCLE;
+      len += writeCycle(&buffer[len]);
+    }
+
+    buffer[1] |= DIAG_RESET;
+    len += writeResets(&buffer[len]);
+    powerPhase(phase);
+
+    log_e(LOG_DIAG_FRAME, logBytes(buffer, len));
 
     // Print first debug messages in loop immediately
     lastPrintTime = 0;
 
     TXCompleted = false;
 
-    // Prepare upstream data transmission at the next possible time.
-    LMIC_setTxData2(1, buffer, sizeof(buffer), cfg.CONFIRMED_DATA_UP);
-    log_d_ln(F("Pck queued"));
+    queueUplink(DIAG_FPORT, buffer, len, false);
+    log_e(LOG_DIAG_QUEUED);
   }
 }
 
@@ -592,7 +2723,14 @@ void lmicStartup()
   {
     // Set static session parameters. Instead of dynamically establishing a session
     // by joining the network, precomputed session parameters are be provided.
-    LMIC_setSession(0x13, cfg.DEVADDR, cfg.NWKSKEY, cfg.APPSKEY);
+    // The keys are only needed here, LMIC keeps its own copy
+    u4_t devaddr;
+    u1_t nwkskey[16];
+    u1_t appskey[16];
+    readConfigKey(CFG_KEY(DEVADDR), &devaddr);
+    readConfigKey(CFG_KEY(NWKSKEY), nwkskey);
+    readConfigKey(CFG_KEY(APPSKEY), appskey);
+    LMIC_setSession(0x13, devaddr, nwkskey, appskey);
 
 #if defined(CFG_eu868)
     // Set up the channels used by the Things Network, which corresponds
@@ -672,76 +2810,186 @@ void lmicStartup()
   // #endif
 }
 
-void do_sleep(uint16_t sleepTime)
+void addSleptTime(uint32_t ms)
+{
+  noInterrupts();
+  sleptMs += ms;
+  interrupts();
+}
+
+void resetDutyCycle()
+{
+  // LMIC does not get that the MCU is sleeping and the
+  // duty cycle limitation then provides a delay.
+  // Reset duty cycle limitation to fix that.
+  LMIC.bands[BAND_MILLI].avail =
+      LMIC.bands[BAND_CENTI].avail =
+          LMIC.bands[BAND_DECI].avail = os_getTime();
+}
+
+// Power down for one watchdog period. A pulse counter interrupt wakes the
+// MCU before the period is over, so sleep again until the watchdog fires.
+// With pinWake an interrupt pin ends the period early, then returns false.
+boolean powerDownPeriod(period_t period, boolean pinWake)
+{
+  uint8_t phase = powerPhase(PHASE_SLEEP);
+  LowPower.powerDown(period, ADC_OFF, BOD_OFF);
+
+  // LowPower enables the watchdog with WDE and WDIE set. WDIE is cleared
+  // when the watchdog interrupt fired, so while it is set, an other
+  // interrupt woke the MCU and the watchdog is still running.
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  noInterrupts();
+  while ((WDTCSR & bit(WDIE)) && !(pinWake && (wakedFromISR0 || wakedFromISR1)))
+  {
+    sleep_enable();
+    sleep_bod_disable();
+    interrupts(); // The next instruction is executed before any interrupt
+    sleep_cpu();
+    sleep_disable();
+    noInterrupts();
+  }
+  boolean elapsed = !(WDTCSR & bit(WDIE));
+  interrupts();
+  powerPhase(phase);
+  return elapsed;
+}
+
+// Sleep until the coalescing window of the queued pin events is over.
+// Further pin events are queued by their ISR and don't end a period.
+void do_sleep_event_window()
+{
+  while (!eventWindowElapsed())
+  {
+    powerDownPeriod(SLEEP_250MS, false);
+    addSleptTime(250UL * SLEEP_MS_PER_S / 1000);
+  }
+  resetDutyCycle();
+}
+
+// Power down for sleepTime seconds (already corrected for the slow watchdog).
+// Returns the remaining seconds if an interrupt pin ended the sleep.
+uint16_t powerDownSeconds(uint16_t sleepTime)
 {
+  // sleep logic using LowPower library
+  uint16_t delays[] = {8, 4, 2, 1};
+  period_t sleeptimes[] = {SLEEP_8S, SLEEP_4S, SLEEP_2S, SLEEP_1S};
   boolean breaksleep = false;
 
-  if (LOG_DEBUG_ENABLED)
+  for (uint8_t i = 0; (i <= 3 && !breaksleep); i++)
   {
-    Serial.print(F("Sleep "));
-    if (sleepTime <= 0)
-    {
-      Serial.println(F("FOREVER\n"));
-    }
-    else
+    for (uint16_t x = sleepTime; (x >= delays[i] && !breaksleep); x -= delays[i])
     {
-      Serial.print(sleepTime);
-      Serial.println(F("s\n"));
+      // Serial.print("i: ");
+      // Serial.print(i);
+      // Serial.print(" TL: ");
+      // Serial.print(sleepTime);
+      // Serial.print(" S: ");
+      // Serial.println(delays[i]);
+      // Serial.flush();
+      if (powerDownPeriod(sleeptimes[i], true))
+      {
+        addSleptTime(delays[i] * (uint32_t)SLEEP_MS_PER_S);
+      }
+      if (wakedFromISR0 || wakedFromISR1)
+      {
+        breaksleep = true;
+      }
+      else
+      {
+        sleepTime -= delays[i];
+      }
     }
-    Serial.flush();
   }
 
-  // sleep logic using LowPower library
+  return sleepTime;
+}
+
+void do_sleep(uint16_t sleepTime)
+{
+  boolean breaksleep = false;
+
   if (sleepTime <= 0)
   {
-    LowPower.powerDown(SLEEP_FOREVER, ADC_OFF, BOD_OFF);
+    log_e(LOG_SLEEP_FOREVER);
   }
   else
   {
+    log_e(LOG_SLEEP, sleepTime);
+  }
+  trace(TRACE_SLEEP, sleepTime >> 8);
+  if (LOG_DEBUG_ENABLED)
+  {
+    Serial.flush(); // The USART stops in power down
+  }
 
-    // Add LORA_MAX_RANDOM_SEND_DELAY of randomness to avoid overlapping of different
-    // nodes with exactly the same sende interval
-    sleepTime += (rand() % LORA_MAX_RANDOM_SEND_DELAY);
+  // sleep logic using LowPower library
+  if (sleepTime <= 0)
+  {
+    // Pulse counter interrupts don't end the sleep
+    uint8_t phase = powerPhase(PHASE_SLEEP);
+    do
+    {
+      LowPower.powerDown(SLEEP_FOREVER, ADC_OFF, BOD_OFF);
+    } while (!(wakedFromISR0 || wakedFromISR1));
+    powerPhase(phase);
+  }
+  else
+  {
+    if (sleepRemaining > 0)
+    {
+      // Resume the sleep interrupted for an event frame
+      sleepTime = sleepRemaining;
+    }
+    else
+    {
+      if (cfg.TX_SLOTTED == 1)
+      {
+        // Move once into the send slot of this node, afterwards keep the interval
+        sleepTime += min(slotOffset, 0xFFFF - sleepTime);
+        slotOffset = 0;
+      }
+      else
+      {
+        // Add LORA_MAX_RANDOM_SEND_DELAY of randomness to avoid overlapping of different
+        // nodes with exactly the same sende interval
+        sleepTime += random(LORA_MAX_RANDOM_SEND_DELAY);
+      }
 
-    // Measurements show that the timer is off by about 12 percent,
-    // so the sleep time is shortened by this value.
-    sleepTime *= 0.88;
+      // Measurements show that the timer is off by about 12 percent,
+      // so the sleep time is shortened by this value.
+      sleepTime = (uint32_t)sleepTime * 88 / 100;
+    }
 
-    // sleep logic using LowPower library
-    uint16_t delays[] = {8, 4, 2, 1};
-    period_t sleeptimes[] = {SLEEP_8S, SLEEP_4S, SLEEP_2S, SLEEP_1S};
-    breaksleep = false;
+    // With window statistics, wake up every STATS_INTERVAL for a sample
+    uint16_t chunk = sleepTime;
+    if (cfg.STATS_INTERVAL > 0)
+    {
+      chunk = max((uint32_t)cfg.STATS_INTERVAL * 88 / 100, 1);
+    }
 
-    for (uint8_t i = 0; (i <= 3 && !breaksleep); i++)
+    while (sleepTime > 0 && !breaksleep)
     {
-      for (uint16_t x = sleepTime; (x >= delays[i] && !breaksleep); x -= delays[i])
+      uint16_t slept = min(chunk, sleepTime);
+      slept -= powerDownSeconds(slept);
+      sleepTime -= slept;
+
+      if (wakedFromISR0 || wakedFromISR1)
       {
-        // Serial.print("i: ");
-        // Serial.print(i);
-        // Serial.print(" TL: ");
-        // Serial.print(sleepTime);
-        // Serial.print(" S: ");
-        // Serial.println(delays[i]);
-        // Serial.flush();
-        LowPower.powerDown(sleeptimes[i], ADC_OFF, BOD_OFF);
-        if (wakedFromISR0 || wakedFromISR1)
-        {
-          breaksleep = true;
-        }
-        else
-        {
-          sleepTime -= delays[i];
-        }
+        breaksleep = true;
+      }
+      else if (cfg.STATS_INTERVAL > 0 && sleepTime > 0)
+      {
+        statsSample();
       }
     }
+
+    // Keep the remaining time, if an event frame is sent before the next telemetry
+    sleepRemaining = breaksleep ? sleepTime : 0;
   }
 
-  // LMIC does not get that the MCU is sleeping and the
-  // duty cycle limitation then provides a delay.
-  // Reset duty cycle limitation to fix that.
-  LMIC.bands[BAND_MILLI].avail =
-      LMIC.bands[BAND_CENTI].avail =
-          LMIC.bands[BAND_DECI].avail = os_getTime();
+  trace(TRACE_WAKE, (wakedFromISR0 ? 1 : 0) | (wakedFromISR1 ? 2 : 0));
+  resetDutyCycle();
 
   // ++++++++++++++++++++++++++++++++++++++++++++++++++ //
   // If that still not work, here a some other things to checkout:
@@ -802,13 +3050,16 @@ void do_sleep(uint16_t sleepTime)
 
 void onEvent(ev_t ev)
 {
+  trace(TRACE_LMIC, ev);
+
   switch (ev)
   {
   case EV_JOINING:
-    log_d_ln(F("Joining..."));
+    log_e(LOG_JOINING);
     break;
   case EV_JOINED:
-    log_d_ln(F("Joined!"));
+    radioTimeAdd();
+    log_e(LOG_JOINED);
 
     if (cfg.ACTIVATION_METHOD == OTAA)
     {
@@ -827,7 +3078,6 @@ void onEvent(ev_t ev)
       //   log_d(F("> NwkSKey: ")); // (MSB)
       //   logHex_d(nwkKey, sizeof(nwkKey));
       //   log_d_ln();
-      log_d_ln();
 
       // Enable ADR explicit (default is alreay enabled)
       LMIC_setAdrMode(1);
@@ -839,24 +3089,80 @@ void onEvent(ev_t ev)
     }
     break;
   case EV_JOIN_FAILED:
-    log_d_ln(F("Join failed"));
+    log_e(LOG_JOIN_FAILED);
     lmicStartup(); // Reset LMIC and retry
     break;
   case EV_REJOIN_FAILED:
-    log_d_ln(F("Rejoin failed"));
+    log_e(LOG_REJOIN_FAILED);
     lmicStartup(); // Reset LMIC and retry
     break;
 
   case EV_TXSTART:
     // log_d_ln(F("EV_TXSTART"));
+    // Retries of a confirmed uplink start without an other event in between
+    radioTimeAdd();
+    txStart = os_getTime();
+    txTimed = false;
+    txAttempts++;
+    limitRetries();
+#ifdef LOG_DEBUG
+    if (isrMicros != 0)
+    {
+      log_e(LOG_ISR_TO_TX, (micros() - isrMicros) / 1000);
+      isrMicros = 0;
+    }
+    if (!firstTxStarted)
+    {
+      log_e(LOG_BOOT_TO_TX, millis());
+      firstTxStarted = true;
+    }
+#endif
     break;
   case EV_TXCOMPLETE:
-    log_d(F("TX done #")); // (includes waiting for RX windows)
-    log_d_ln(LMIC.seqnoUp);
+    radioTimeAdd();
+    log_e(LOG_TX_DONE, LMIC.seqnoUp); // (includes waiting for RX windows)
     if (LMIC.txrxFlags & TXRX_ACK)
-      log_d_ln(F("> Got ack"));
+    {
+      log_e(LOG_ACK);
+
+      // Remember link quality for the retries of the next confirmed uplink
+      // LMIC.snr is in 0.25 dB steps, LMIC.rssi has an offset of RSSI_OFF
+      lastAckSnr = LMIC.snr / 4;
+      lastAckRssi = LMIC.rssi - RSSI_OFF;
+      ackReceived = true;
+    }
     if (LMIC.txrxFlags & TXRX_NACK)
-      log_d_ln(F("> Got NO ack"));
+      log_e(LOG_NACK);
+
+    if (cfg.BACKLOG == 1)
+    {
+      if (txPort == DATA_FPORT && (LMIC.txrxFlags & TXRX_NACK))
+      {
+        // Network unreachable, keep the sample for later
+        backlogPush(lastSample);
+      }
+      else if (txPort == BACKLOG_FPORT && (LMIC.txrxFlags & TXRX_ACK))
+      {
+        backlogPop(backlogSent);
+      }
+
+      // Link is back, send one catch-up frame per wakeup
+      if (txPort != BACKLOG_FPORT && (LMIC.txrxFlags & TXRX_ACK) && backlogLen > 0)
+      {
+        doSendBacklog = true;
+      }
+    }
+
+    if (txPort == DATA_FPORT || txPort == EVENT_FPORT)
+    {
+      cycleEnd();
+    }
+
+    if (txPort == DATA_FPORT && cfg.DIAG_INTERVAL > 0 && ++uplinksSinceDiag >= cfg.DIAG_INTERVAL)
+    {
+      uplinksSinceDiag = 0;
+      doSendDiag = true;
+    }
 
     // if (LMIC.dataLen)
     // {
@@ -880,11 +3186,13 @@ void onEvent(ev_t ev)
     break;
 
   case EV_JOIN_TXCOMPLETE:
-    log_d_ln(F("NO JoinAccept"));
+    radioTimeAdd();
+    log_e(LOG_NO_JOIN_ACCEPT);
     break;
 
   case EV_TXCANCELED:
-    log_d_ln(F("TX canceled!"));
+    radioTimeAdd();
+    log_e(LOG_TX_CANCELED);
     break;
   case EV_BEACON_FOUND:
   case EV_BEACON_MISSED:
@@ -899,8 +3207,7 @@ void onEvent(ev_t ev)
 
   case EV_RXSTART:
   default:
-    log_d(F("Unknown Evt: "));
-    log_d_ln((unsigned)ev);
+    log_e(LOG_UNKNOWN_EVENT, (unsigned)ev);
     break;
   }
 }
@@ -909,35 +3216,18 @@ void handleISR()
 {
   if (wakedFromISR0 || wakedFromISR1)
   {
-    log_d(F("Waked from ItrPin "));
     if (wakedFromISR0)
     {
-      log_d_ln(F("0!"));
-      pinState |= STATE_ITR0;    // set bit in pinState byte to 1
-      pinState &= ~(STATE_ITR1); // set bit in pinState byte to 0
+      log_e(LOG_WAKE_ITR, 0);
     }
 
     if (wakedFromISR1)
     {
-      Serial.println(F("1!"));
-      pinState |= STATE_ITR1;    // set bit in pinState byte to 1
-      pinState &= ~(STATE_ITR0); // set bit in pinState byte to 0
-    }
-
-    // set STATE_ITR_EVT bit in pinState byte to 1
-    // this means this pin was set now
-    pinState |= STATE_ITR_TRIGGER;
-
-    // Remove data previously prepared for upstream transmission.
-    // If transmit messages are pending, the event EV_TXCOMPLETE will be reported.
-    if (!TXCompleted)
-    {
-      LMIC_clrTxData();
+      log_e(LOG_WAKE_ITR, 1);
     }
 
-    // send new data;
-    doSend = true;
-
+    // The pin events are queued by the ISR and sent after the
+    // coalescing window, see loop()
     wakedFromISR0 = false;
     wakedFromISR1 = false;
   }
@@ -950,8 +3240,173 @@ void reset_itr_trigger_state()
   pinState &= ~(STATE_ITR_TRIGGER);
 }
 
+// Order the addresses by ROM code, so the order of the sensors in the
+// payload doesn't depend on the search order
+void sortAddresses(DeviceAddress *addresses, uint8_t count)
+{
+  for (uint8_t i = 1; i < count; i++)
+  {
+    DeviceAddress key;
+    memcpy(key, addresses[i], sizeof(DeviceAddress));
+
+    uint8_t j = i;
+    while (j > 0 && memcmp(addresses[j - 1], key, sizeof(DeviceAddress)) > 0)
+    {
+      memcpy(addresses[j], addresses[j - 1], sizeof(DeviceAddress));
+      j--;
+    }
+    memcpy(addresses[j], key, sizeof(DeviceAddress));
+  }
+}
+
+// Search all sensors, in config mode also print their values
+void probeSensors()
+{
+  // One bus search, the addresses are read from the table afterwards
+  ds.begin(dsSensors, DS_MAX_SENSORS);
+  dsCount = min(ds.getDeviceCount(), DS_MAX_SENSORS);
+  sortAddresses(dsSensors, dsCount);
+  foundDS = dsCount > 0;
+  if (CONFIG_MODE_ENABLED)
+  {
+    ds.requestTemperatures(); // Only needed to print the temperatures
+  }
+
+  log_e(LOG_DS_FOUND, ds.getDeviceCount());
+
+  for (uint8_t i = 0; i < dsCount && CONFIG_MODE_ENABLED; i++)
+  {
+    Serial.print(F("> #"));
+    Serial.print(i);
+    Serial.print(F(": "));
+    printHex(dsSensors[i], sizeof(DeviceAddress));
+    Serial.print(" --> ");
+    uint8_t scratchPad[9];
+    ds.readScratchPad(dsSensors[i], scratchPad);
+    printHex(scratchPad, sizeof(scratchPad));
+    Serial.print(" --> ");
+    printCenti(ds.getTemp100(dsSensors[i]));
+    Serial.print(" °C");
+    Serial.println();
+  }
+
+  // BME280 forced mode, 1x temperature / 1x humidity / 1x pressure oversampling, filter off
+  if (bme.begin(I2C_ADR_BME))
+  {
+    foundBME = true;
+    log_e(LOG_BME_FOUND, 1);
+    if (CONFIG_MODE_ENABLED)
+    {
+      bme.takeForcedMeasurement();
+      Serial.print(F("> Temperatur: "));
+      printCenti(bme.readTemperature100());
+      Serial.println(" °C");
+      Serial.print(F("> Humidity: "));
+      printCenti(bme.readHumidity100());
+      Serial.println(" %RH");
+      Serial.print(F("> Pressure: "));
+      printCenti(bme.readPressurePa());
+      Serial.println(" hPa");
+    }
+  }
+  else
+  {
+    log_e(LOG_BME_FOUND, 0);
+  }
+}
+
+// Take the sensors from the cache, if the cached sensors still answer.
+// Returns false if the cache is invalid or does not match the sensors.
+boolean loadSensorCache()
+{
+  sensorCache_t cache;
+
+  EEPROM.get(SENSOR_CACHE_START, cache);
+  if (CRC32::calculate((byte *)&cache, offsetof(sensorCache_t, crc)) != cache.crc)
+  {
+    log_e(LOG_CACHE_INVALID);
+    return false;
+  }
+
+  // Each cached DS18x must return a valid scratchpad, without a cached
+  // sensor no device may answer the reset with a presence pulse
+  if (cache.dsCount == 0 ? oneWire.reset() : cache.dsCount > DS_MAX_SENSORS)
+  {
+    log_e(LOG_CACHE_MISMATCH_DS);
+    return false;
+  }
+  for (uint8_t i = 0; i < cache.dsCount; i++)
+  {
+    if (ds.getTemp(cache.dsSensors[i]) == DEVICE_DISCONNECTED_RAW)
+    {
+      log_e(LOG_CACHE_MISMATCH_DS);
+      return false;
+    }
+  }
+
+  // A probe added later is found by a ROM search without conversion: one
+  // search pass per device, the count must match the cache
+  if (cache.dsCount > 0)
+  {
+    DeviceAddress rom;
+    uint8_t count = 0;
+    while (count <= DS_MAX_SENSORS && oneWire.search(rom))
+    {
+      count += ds.validAddress(rom) && ds.validFamily(rom);
+    }
+    oneWire.reset_search();
+    if (min(count, DS_MAX_SENSORS) != cache.dsCount)
+    {
+      log_e(LOG_CACHE_MISMATCH_DS);
+      return false;
+    }
+  }
+
+  // Chip ID check only, the coefficients come from the cache
+  if (cache.bme ? !bme.begin(I2C_ADR_BME, &cache.bmeCalib) : bme.begin(I2C_ADR_BME))
+  {
+    log_e(LOG_CACHE_MISMATCH_BME);
+    return false;
+  }
+
+  dsCount = cache.dsCount;
+  memcpy(dsSensors, cache.dsSensors, sizeof(dsSensors));
+  foundDS = dsCount > 0;
+  foundBME = cache.bme;
+
+  log_e(LOG_CACHE_LOADED, cache.dsCount, cache.bme);
+
+  return true;
+}
+
+// Store the result of probeSensors(). EEPROM.put() only writes changed bytes.
+void saveSensorCache()
+{
+  sensorCache_t cache;
+
+  memset(&cache, 0, sizeof(cache));
+  cache.dsCount = dsCount;
+  memcpy(cache.dsSensors, dsSensors, sizeof(dsSensors));
+  cache.bme = foundBME;
+  if (foundBME)
+  {
+    cache.bmeCalib = bme.getCalibration();
+  }
+  cache.crc = CRC32::calculate((byte *)&cache, offsetof(sensorCache_t, crc));
+
+  EEPROM.put(SENSOR_CACHE_START, cache);
+}
+
 void setup()
 {
+  resetInit();
+
+#ifdef PHASE_MARKER_PIN
+  pinMode(PHASE_MARKER_PIN, OUTPUT);
+#endif
+  // Stop the clock of all peripherals not needed while awake
+  powerPhase(PHASE_AWAKE);
+
   // use the 1.1 V internal reference
   analogReference(INTERNAL);
 
@@ -965,13 +3420,10 @@ void setup()
     delay(100); // per sample code on RF_95 test
   }
 
-  log_d(F("\n= Starting LoRaProMini v"));
-  log_d(VERSION_MAJOR);
-  log_d(F("."));
-  log_d(VERSION_MINOR);
-  log_d_ln(F(" ="));
+  log_e(LOG_BOOT, VERSION_MAJOR, VERSION_MINOR);
 
   readConfig();
+  seedSendDelay();
 
   if (CONFIG_MODE_ENABLED)
   {
@@ -980,80 +3432,32 @@ void setup()
   }
   else
   {
-    if (!cfg.CONFIG_IS_VALID)
+    if (cfg.CONFIG_IS_VALID != CONFIG_VALID)
     {
-      log_d_ln(F("INVALID CONFIG!"));
+      log_e(LOG_CONFIG_INVALID);
       while (true)
       {
       }
     }
   }
 
-  log_d(F("Search DS18x..."));
-
-  ds.begin();
-  ds.requestTemperatures();
-
-  log_d(ds.getDeviceCount(), DEC);
-  log_d_ln(F(" found"));
+  // A stuck I2C bus must not block the node, reset the bus after a timeout
+#if defined(WIRE_HAS_TIMEOUT)
+  Wire.setWireTimeout(I2C_TIMEOUT_US, true);
+#endif
 
-  for (uint8_t i = 0; i < ds.getDeviceCount(); i++)
+  // The full probe takes about a second, skip it if the sensors are still the same
+  uint8_t phase = powerPhase(PHASE_TWI);
+  if (CONFIG_MODE_ENABLED || !loadSensorCache())
   {
-    if (CONFIG_MODE_ENABLED)
-    {
-      Serial.print(F("> #"));
-      Serial.print(i);
-      Serial.print(F(": "));
-    }
-    DeviceAddress deviceAddress;
-    if (ds.getAddress(deviceAddress, i))
-    {
-      foundDS = true;
-
-      // Save first sensor as measurement sensor for later
-      if (i == 0)
-      {
-        memcpy(dsSensor, deviceAddress, sizeof(deviceAddress) / sizeof(*deviceAddress));
-      }
-
-      if (CONFIG_MODE_ENABLED)
-      {
-        printHex(deviceAddress, sizeof(deviceAddress));
-        Serial.print(" --> ");
-        uint8_t scratchPad[9];
-        ds.readScratchPad(deviceAddress, scratchPad);
-        printHex(scratchPad, sizeof(scratchPad));
-        Serial.print(" --> ");
-        Serial.print(ds.getTempC(deviceAddress));
-        Serial.print(" °C");
-        Serial.println();
-      }
-    }
+    probeSensors();
+    saveSensorCache();
   }
+  powerPhase(phase);
 
-  // BME280 forced mode, 1x temperature / 1x humidity / 1x pressure oversampling, filter off
-  log_d(F("Search BME..."));
-  if (bme.begin(I2C_ADR_BME))
-  {
-    foundBME = true;
-    log_d_ln(F("1 found"));
-    if (CONFIG_MODE_ENABLED)
-    {
-      bme.takeForcedMeasurement();
-      Serial.print(F("> Temperatur: "));
-      Serial.print(bme.readTemperature());
-      Serial.println(" °C");
-      Serial.print(F("> Humidity: "));
-      Serial.print(bme.readHumidity());
-      Serial.println(" %RH");
-      Serial.print(F("> Pressure: "));
-      Serial.print(bme.readPressure() / 100.0F);
-      Serial.println(" hPa");
-    }
-  }
-  else
+  if (cfg.DS_ALARM == 1)
   {
-    log_d_ln(F("0 found"));
+    setupAlarms();
   }
 
   // Allow wake up pin to trigger interrupt on low.
@@ -1066,6 +3470,13 @@ void setup()
   wakedFromISR0 = false;
   wakedFromISR1 = false;
 
+  setupPulseCounters();
+
+  if (cfg.BACKLOG == 1)
+  {
+    backlogInit();
+  }
+
   // Start LoRa stuff if not in config mode
   if (!CONFIG_MODE_ENABLED)
   {
@@ -1075,12 +3486,10 @@ void setup()
     // Reset the MAC state. Session and pending data transfers will be discarded.
     lmicStartup();
 
-    Serial.print(F("Join mode "));
-
     // ABP Mode
     if (cfg.ACTIVATION_METHOD == ABP)
     {
-      Serial.println(F("ABP"));
+      log_e(LOG_JOIN_ABP);
       // Start job in ABP Mode
       do_send(&sendjob);
     }
@@ -1088,7 +3497,7 @@ void setup()
     // OTAA Mode
     else if (cfg.ACTIVATION_METHOD == OTAA)
     {
-      Serial.println(F("OTAA"));
+      log_e(LOG_JOIN_OTAA);
       // Start job (sending automatically starts OTAA too)
       // Join the network, sending will be started after the event "Joined"
       LMIC_startJoining();
@@ -1109,37 +3518,70 @@ void loop()
     os_runloop_once();
 
     // Previous TX is complete and also no critical jobs pending in LMIC
-    if (TXCompleted)
+    // Queued pin events are sent before going to sleep
+    if (TXCompleted && !eventsQueued() && !doSendBacklog && !doSendDiag)
     {
       // Going to sleep
       boolean sleep = true;
       while (sleep)
       {
-        do_sleep(cfg.SLEEPTIME);
-        if (readBat() >= cfg.BAT_MIN_VOLTAGE)
+        // Report faster while a probe is in alarm
+        do_sleep(dsAlarms && cfg.ALARM_SLEEPTIME > 0 ? cfg.ALARM_SLEEPTIME : cfg.SLEEPTIME);
+        uint16_t bat = readBat();
+        if (bat >= cfg.BAT_MIN_MV)
         {
           sleep = false;
         }
         else
         {
-          log_d_ln(F("Bat to low!"));
+          log_e(LOG_BAT_LOW);
+          trace(TRACE_BAT_LOW, min(bat / TRACE_BAT_MV, 0xFF));
         }
       }
 
       handleISR();
 
       // sleep ended. do next transmission
-      doSend = true;
+      // (an interrupt sends the queued pin events instead)
+      if (!eventsQueued())
+      {
+        doSend = true;
+      }
     }
     if (lastPrintTime == 0 || lastPrintTime + 1000 < millis())
     {
-      log_d_ln(F("> Can't sleep"));
+      log_e(LOG_CANT_SLEEP);
       lastPrintTime = millis();
     }
 
     handleISR();
 
-    if (doSend)
+    // Send queued pin events after the previous TX is complete
+    if (TXCompleted && eventsQueued())
+    {
+      do_sleep_event_window();
+      doSend = false;
+      if (cfg.EVENT_FAST_PATH == 1)
+      {
+        do_send_event(&sendjob);
+      }
+      else
+      {
+        do_send(&sendjob);
+      }
+      reset_itr_trigger_state();
+    }
+    else if (TXCompleted && doSendBacklog)
+    {
+      doSendBacklog = false;
+      do_send_backlog(&sendjob);
+    }
+    else if (TXCompleted && doSendDiag)
+    {
+      doSendDiag = false;
+      do_send_diag(&sendjob);
+    }
+    else if (doSend)
     {
       doSend = false;
       do_send(&sendjob);
@@ -0,0 +1,141 @@
+// Store-and-forward backlog: an outage, the recovery and the catch-up frames. The
+// samples are told apart by their battery reading, every uplink changes the ADC value.
+// Run with: pio test -e native
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <lmic.h>
+#include <unity.h>
+#include "sim.h"
+
+// Offset of BACKLOG in configData_t (main.cpp)
+#define CFG_BACKLOG 92
+
+#define DATA_FPORT 1
+#define BACKLOG_FPORT 3
+#define BLOCK_BAT 0x01
+#define BLOCK_BME 0x02
+
+#define OUTAGE_UPLINKS 12
+#define MAX_SAMPLES 32
+
+// Defined in main.cpp
+void setup();
+void loop();
+extern uint8_t backlogLen;
+
+static uint16_t uplinks;
+static uint32_t fcnt;
+static boolean fcntRising = true;
+
+// Battery readings of the samples not acknowledged and of the samples in catch-up frames
+static uint16_t lost[MAX_SAMPLES];
+static uint8_t lostCount;
+static uint16_t caughtUp[MAX_SAMPLES];
+static uint8_t caughtUpCount;
+static uint8_t catchUpFrames;
+
+static uint16_t bat(const uint8_t *data)
+{
+  return (data[0] << 8) | data[1];
+}
+
+// Samples of a catch-up frame: age (3 bytes), content and the sensor blocks
+static void readCatchUp(const uint8_t *data, uint8_t len)
+{
+  uint8_t pos = 1;
+
+  for (uint8_t i = 0; i < data[0]; i++)
+  {
+    uint8_t content = data[pos + 3];
+    pos += 4;
+    TEST_ASSERT_TRUE(content & BLOCK_BAT);
+    TEST_ASSERT_LESS_THAN(MAX_SAMPLES, caughtUpCount);
+    caughtUp[caughtUpCount++] = bat(&data[pos]);
+    pos += 2 + (content & BLOCK_BME ? 6 : 0);
+  }
+  TEST_ASSERT_EQUAL_UINT8(len, pos);
+}
+
+static void onUplink(uint8_t port, uint32_t frameFcnt, uint8_t attempts, const uint8_t *data, uint8_t len,
+                     uint8_t txrxFlags)
+{
+  if (uplinks > 0 && frameFcnt != fcnt + 1)
+  {
+    fcntRising = false;
+  }
+  uplinks++;
+  fcnt = frameFcnt;
+
+  if (port == DATA_FPORT && (txrxFlags & TXRX_NACK))
+  {
+    TEST_ASSERT_TRUE(data[2] & BLOCK_BAT);
+    lost[lostCount++] = bat(&data[3]);
+  }
+  if (port == BACKLOG_FPORT && (txrxFlags & TXRX_ACK))
+  {
+    catchUpFrames++;
+    readCatchUp(data, len);
+  }
+
+  // The next sample gets a different battery reading
+  simAdc++;
+}
+
+static void runUplinks(uint16_t n)
+{
+  uint16_t end = uplinks + n;
+
+  while (uplinks < end)
+  {
+    loop();
+  }
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// Every data uplink without ACK goes to the backlog
+void test_outage()
+{
+  simNoNetwork = true;
+  runUplinks(OUTAGE_UPLINKS);
+  simNoNetwork = false;
+  TEST_ASSERT_EQUAL_UINT8(OUTAGE_UPLINKS, lostCount);
+  TEST_ASSERT_EQUAL_UINT8(OUTAGE_UPLINKS, backlogLen);
+}
+
+// After the link is back, one catch-up frame follows every data uplink until
+// the backlog is empty. Every frame gets a new frame counter, so none is dropped
+// as a replay, and every sample is sent once, the oldest first.
+void test_recovery()
+{
+  for (uint8_t i = 0; i < 4 * OUTAGE_UPLINKS && backlogLen > 0; i++)
+  {
+    runUplinks(1);
+  }
+  TEST_ASSERT_EQUAL_UINT8(0, backlogLen);
+  TEST_ASSERT_GREATER_THAN_UINT8(1, catchUpFrames);
+  TEST_ASSERT_TRUE(fcntRising);
+  TEST_ASSERT_EQUAL_UINT8(lostCount, caughtUpCount);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(lost, caughtUp, lostCount);
+}
+
+int main()
+{
+  simQuiet = true;
+  simInit();
+  EEPROM.data[CFG_BACKLOG] = 1;
+  simOnUplink = onUplink;
+  setup();
+  runUplinks(1);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_outage);
+  RUN_TEST(test_recovery);
+  return UNITY_END();
+}
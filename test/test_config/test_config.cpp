@@ -0,0 +1,85 @@
+// Migration of a config written by version 2.7 and older: float battery values and
+// only 82 bytes, the EEPROM after the keys was never written.
+// Run with: pio test -e native
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <unity.h>
+#include "sim.h"
+
+// Layout of the old config
+#define OLD_CFG_SIZE 82
+#define OLD_BAT_SENSE_VPB 3
+#define OLD_BAT_MIN_VOLTAGE 7
+
+// Offsets in configData_t (main.cpp)
+#define CFG_CONFIG_IS_VALID 0
+#define CFG_BAT_SENSE_UVPB 3
+#define CFG_BAT_MIN_MV 7
+#define CFG_CONFIRM_EVERY_N 82
+#define CFG_CONFIRM_RETRIES 83
+#define CFG_SENSORS_PERIODIC 88
+#define CFG_SENSORS_ITR1 90
+#define CFG_DIAG_INTERVAL 100
+
+#define CONFIG_VALID_FLOAT 1
+#define CONFIG_VALID 2
+
+// Defined in main.cpp
+void readConfig();
+
+static uint32_t read32(uint8_t offset)
+{
+  uint32_t value;
+  memcpy(&value, &EEPROM.data[offset], sizeof(value));
+  return value;
+}
+
+void setUp()
+{
+  float vpb = 0.00432;
+  float minVoltage = 2.8;
+
+  simInit();
+  memset(&EEPROM.data[OLD_CFG_SIZE], 0xFF, CFG_DIAG_INTERVAL + 1 - OLD_CFG_SIZE);
+  EEPROM.data[CFG_CONFIG_IS_VALID] = CONFIG_VALID_FLOAT;
+  memcpy(&EEPROM.data[OLD_BAT_SENSE_VPB], &vpb, sizeof(vpb));
+  memcpy(&EEPROM.data[OLD_BAT_MIN_VOLTAGE], &minVoltage, sizeof(minVoltage));
+  readConfig();
+}
+
+void tearDown()
+{
+}
+
+void test_battery_values_converted()
+{
+  TEST_ASSERT_EQUAL_UINT8(CONFIG_VALID, EEPROM.data[CFG_CONFIG_IS_VALID]);
+  // floatToScaled() cuts the mantissa, 0.1 % is below the resolution of the ADC
+  TEST_ASSERT_UINT32_WITHIN(4, 4320, read32(CFG_BAT_SENSE_UVPB));
+  TEST_ASSERT_UINT32_WITHIN(3, 2800, read32(CFG_BAT_MIN_MV));
+}
+
+// The fields after the keys get the behaviour of the old version, not 0xFF
+void test_new_fields_defaulted()
+{
+  TEST_ASSERT_EQUAL_UINT8(0, EEPROM.data[CFG_CONFIRM_EVERY_N]);
+  TEST_ASSERT_EQUAL_UINT8(7, EEPROM.data[CFG_CONFIRM_RETRIES]);
+  for (uint8_t i = CFG_SENSORS_PERIODIC; i <= CFG_SENSORS_ITR1; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(7, EEPROM.data[i]);
+  }
+  for (uint8_t i = CFG_SENSORS_ITR1 + 1; i <= CFG_DIAG_INTERVAL; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(0, EEPROM.data[i]);
+  }
+}
+
+int main()
+{
+  simQuiet = true;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_battery_values_converted);
+  RUN_TEST(test_new_fields_defaulted);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+// Frame counter and retransmissions of confirmed uplinks. The LMIC of the native
+// simulation builds the frame when the TX starts, as the MCCI LMIC does when the TX
+// is deferred, and only counts up the frame counter for a frame built with txCnt 0.
+// Run with: pio test -e native
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <lmic.h>
+#include <unity.h>
+#include "sim.h"
+
+// Offsets in configData_t (main.cpp)
+#define CFG_CONFIRMED_DATA_UP 12
+#define CFG_CONFIRM_RETRIES 83
+
+#define CONFIRMED 1
+#define RETRIES 2
+
+// Defined in main.cpp
+void setup();
+void loop();
+
+static uint16_t uplinks;
+static uint32_t fcnt;
+static uint8_t attempts;
+static uint8_t txrxFlags;
+static boolean fcntRising;
+
+static void onUplink(uint8_t port, uint32_t frameFcnt, uint8_t frameAttempts, const uint8_t *data, uint8_t len,
+                     uint8_t flags)
+{
+  if (uplinks > 0 && frameFcnt != fcnt + 1)
+  {
+    fcntRising = false;
+  }
+  uplinks++;
+  fcnt = frameFcnt;
+  attempts = frameAttempts;
+  txrxFlags = flags;
+}
+
+static void runUplinks(uint16_t n)
+{
+  uint16_t end = uplinks + n;
+
+  while (uplinks < end)
+  {
+    loop();
+  }
+}
+
+void setUp()
+{
+  fcntRising = true;
+}
+
+void tearDown()
+{
+}
+
+void test_fcnt_rises_with_ack()
+{
+  uint32_t first = fcnt;
+
+  runUplinks(5);
+  TEST_ASSERT_TRUE(fcntRising);
+  TEST_ASSERT_EQUAL_UINT32(first + 5, fcnt);
+  TEST_ASSERT_EQUAL_UINT8(1, attempts);
+  TEST_ASSERT_TRUE(txrxFlags & TXRX_ACK);
+}
+
+// Without ACK every frame is sent RETRIES + 1 times with the same frame counter,
+// the next frame gets a new one
+void test_retries_keep_fcnt()
+{
+  uint32_t first = fcnt;
+
+  simNoNetwork = true;
+  runUplinks(3);
+  simNoNetwork = false;
+  TEST_ASSERT_TRUE(fcntRising);
+  TEST_ASSERT_EQUAL_UINT32(first + 3, fcnt);
+  TEST_ASSERT_EQUAL_UINT8(RETRIES + 1, attempts);
+  TEST_ASSERT_TRUE(txrxFlags & TXRX_NACK);
+}
+
+void test_fcnt_rises_after_nack()
+{
+  uint32_t first = fcnt;
+
+  runUplinks(2);
+  TEST_ASSERT_TRUE(fcntRising);
+  TEST_ASSERT_EQUAL_UINT32(first + 2, fcnt);
+  TEST_ASSERT_TRUE(txrxFlags & TXRX_ACK);
+}
+
+int main()
+{
+  simQuiet = true;
+  simInit();
+  EEPROM.data[CFG_CONFIRMED_DATA_UP] = CONFIRMED;
+  EEPROM.data[CFG_CONFIRM_RETRIES] = RETRIES;
+  simOnUplink = onUplink;
+  setup();
+  runUplinks(1);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_fcnt_rises_with_ack);
+  RUN_TEST(test_retries_keep_fcnt);
+  RUN_TEST(test_fcnt_rises_after_nack);
+  return UNITY_END();
+}
@@ -0,0 +1,235 @@
+// DS18x probes in the data uplink: order by ROM code, missing probes and the
+// max. payload of the data rate. The probes are the 1-Wire models of the native
+// simulation, the frames are taken from the LMIC of the simulation.
+// Run with: pio test -e native
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <lmic.h>
+#include <unity.h>
+#include "sim.h"
+
+// Offsets in configData_t (main.cpp)
+#define CFG_PULSE_COUNTERS 87
+#define CFG_STATS_INTERVAL 93
+#define CFG_DS_ALARM 95
+#define CFG_DS_ALARM_HIGH 96
+#define CFG_DS_ALARM_LOW 97
+
+// _PayloadBlock in main.cpp
+#define BLOCK_BAT 0x01
+#define BLOCK_BME 0x02
+#define BLOCK_DS 0x04
+#define BLOCK_EVENTS 0x08
+#define BLOCK_PULSE 0x10
+#define BLOCK_STATS 0x20
+#define BLOCK_STATUS 0x40
+#define BLOCK_DS_ALARM 0x80
+
+#define DS_DISCONNECTED -12700
+
+// Defined in main.cpp
+void setup();
+void do_send(osjob_t *j);
+void probeSensors();
+boolean loadSensorCache();
+void saveSensorCache();
+void transferConfig(boolean write);
+void setupAlarms();
+void setupPulseCounters();
+
+static osjob_t job;
+static const uint8_t *frame;
+static uint8_t frameLen;
+static uint8_t dsBlock; // Offset of the DS18x block in the frame
+
+static uint8_t bits(uint8_t value)
+{
+  uint8_t n = 0;
+  for (; value; value >>= 1)
+  {
+    n += value & 1;
+  }
+  return n;
+}
+
+// Queue a data uplink and walk its blocks, they must end with the frame
+static void send()
+{
+  uint8_t port;
+
+  LMIC.opmode &= ~OP_TXRXPEND;
+  do_send(&job);
+  frameLen = simTxFrame(&port, &frame);
+  TEST_ASSERT_EQUAL_UINT8(1, port);
+
+  uint8_t content = frame[2];
+  uint8_t pos = 3;
+  pos += content & BLOCK_BAT ? 2 : 0;
+  pos += content & BLOCK_BME ? 6 : 0;
+  dsBlock = pos;
+  pos += content & BLOCK_DS ? 1 + frame[pos] * 2 : 0;
+  pos += content & BLOCK_EVENTS ? 1 + (frame[pos] & 0x7F) * 2 : 0;
+  pos += content & BLOCK_PULSE ? 1 + bits(frame[pos]) * 2 : 0;
+  pos += content & BLOCK_STATS ? 2 + (frame[pos + 1] & BLOCK_BME ? 18 : 0) + (frame[pos + 1] & BLOCK_DS ? 6 : 0) : 0;
+  pos += content & BLOCK_STATUS ? 2 : 0;
+  pos += content & BLOCK_DS_ALARM ? 1 + bits(frame[pos]) * 2 : 0;
+  TEST_ASSERT_EQUAL_UINT8(frameLen, pos);
+}
+
+static int16_t probeTemp(uint8_t i)
+{
+  return (int16_t)((frame[dsBlock + 1 + i * 2] << 8) | frame[dsBlock + 2 + i * 2]);
+}
+
+static void pinEvent()
+{
+  simPinEdge(2, HIGH);
+  simRun(100000);
+  simPinEdge(2, LOW);
+  simRun(100000);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// The bus search finds the probes in a different order (bit 0 first),
+// the payload has them ordered by ROM code, i.e. in the order they were added
+void test_probes_in_rom_order()
+{
+  for (uint8_t n = 1; n <= 8; n++)
+  {
+    simAddDs(false, 1000 + (n - 1) * 100);
+    probeSensors();
+    send();
+    TEST_ASSERT_TRUE(frame[2] & BLOCK_DS);
+    TEST_ASSERT_EQUAL_UINT8(n, frame[dsBlock]);
+    for (uint8_t i = 0; i < n; i++)
+    {
+      TEST_ASSERT_EQUAL_INT16(1000 + i * 100, probeTemp(i));
+    }
+  }
+}
+
+// A probe lost after boot keeps its place, without the first probe there is no DS18x block
+void test_missing_probes()
+{
+  simDsConnect(3, false);
+  send();
+  TEST_ASSERT_EQUAL_UINT8(8, frame[dsBlock]);
+  TEST_ASSERT_EQUAL_INT16(1200, probeTemp(2));
+  TEST_ASSERT_EQUAL_INT16(DS_DISCONNECTED, probeTemp(3));
+  TEST_ASSERT_EQUAL_INT16(1400, probeTemp(4));
+
+  simDsConnect(0, false);
+  send();
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_DS);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_STATUS);
+
+  simDsConnect(0, true);
+  simDsConnect(3, true);
+  send();
+  TEST_ASSERT_EQUAL_UINT8(8, frame[dsBlock]);
+  TEST_ASSERT_EQUAL_INT16(1300, probeTemp(3));
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_STATUS);
+}
+
+// The boot uses the sensor cache while the cached probes answer. A probe
+// connected later doesn't invalidate them, the bus search count does.
+void test_cache_new_probe()
+{
+  simDsConnect(7, false);
+  probeSensors();
+  saveSensorCache();
+  TEST_ASSERT_TRUE(loadSensorCache());
+  send();
+  TEST_ASSERT_EQUAL_UINT8(7, frame[dsBlock]);
+
+  simDsConnect(7, true);
+  TEST_ASSERT_FALSE(loadSensorCache());
+  probeSensors();
+  saveSensorCache();
+  TEST_ASSERT_TRUE(loadSensorCache());
+  send();
+  TEST_ASSERT_EQUAL_UINT8(8, frame[dsBlock]);
+  TEST_ASSERT_EQUAL_INT16(1700, probeTemp(7));
+}
+
+// DR0-2 allow 51 bytes. The other blocks leave room for 8 probes if the
+// statistics are left out, they follow when there is space again.
+void test_frame_size_cap()
+{
+  EEPROM.data[CFG_PULSE_COUNTERS] = 0b11;
+  EEPROM.data[CFG_STATS_INTERVAL] = 60;
+  transferConfig(false);
+  setupPulseCounters();
+  LMIC.datarate = DR_SF12;
+
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    pinEvent();
+  }
+  send();
+  TEST_ASSERT_LESS_OR_EQUAL(51, frameLen);
+  TEST_ASSERT_EQUAL_UINT8(8, frame[dsBlock]);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_EVENTS);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_PULSE);
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_STATS);
+
+  // Without events there is room for the statistics, but not for all probes.
+  // The statistics replace the BME280 block, the further probes stay.
+  send();
+  TEST_ASSERT_EQUAL_UINT8(51, frameLen);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_STATS);
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_BME);
+  TEST_ASSERT_EQUAL_UINT8(7, frame[dsBlock]);
+}
+
+// All 8 probes in alarm: the alarm block and the events are always sent,
+// the pulse deltas and the statistics wait for a later uplink
+void test_frame_size_cap_alarms()
+{
+  EEPROM.data[CFG_DS_ALARM] = 1;
+  EEPROM.data[CFG_DS_ALARM_HIGH] = 5;
+  EEPROM.data[CFG_DS_ALARM_LOW] = 0;
+  transferConfig(false);
+  setupAlarms();
+
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    pinEvent();
+  }
+  send();
+  TEST_ASSERT_LESS_OR_EQUAL(51, frameLen);
+  TEST_ASSERT_EQUAL_UINT8(1, frame[dsBlock]);
+  TEST_ASSERT_EQUAL_INT16(1000, probeTemp(0));
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_EVENTS);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_DS_ALARM);
+  TEST_ASSERT_EQUAL_HEX8(0xFF, frame[frameLen - 17]);
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_PULSE);
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_STATS);
+
+  send();
+  TEST_ASSERT_LESS_OR_EQUAL(51, frameLen);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_PULSE);
+  TEST_ASSERT_TRUE(frame[2] & BLOCK_DS_ALARM);
+}
+
+int main()
+{
+  simQuiet = true;
+  simInit();
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_probes_in_rom_order);
+  RUN_TEST(test_missing_probes);
+  RUN_TEST(test_cache_new_probe);
+  RUN_TEST(test_frame_size_cap);
+  RUN_TEST(test_frame_size_cap_alarms);
+  return UNITY_END();
+}
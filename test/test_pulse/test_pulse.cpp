@@ -0,0 +1,156 @@
+// Pulse counters on D4/D5 at high pulse rates. The edges are driven through the
+// pin HAL of the native simulation, the counts are read from the pulse block.
+// Run with: pio test -e native
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LowPower.h>
+#include <unity.h>
+#include "sim.h"
+
+// Offset of PULSE_COUNTERS in configData_t (main.cpp)
+#define CFG_PULSE_COUNTERS 87
+
+// Defined in main.cpp
+void setup();
+boolean powerDownPeriod(period_t period, boolean pinWake);
+uint8_t writePulseDeltas(byte *buffer);
+extern volatile boolean wakedFromISR0;
+extern volatile boolean wakedFromISR1;
+extern "C" void PCINT2_vect(void);
+
+static uint16_t delta[2];
+
+// Deltas since the last read, as the next uplink would send them
+static void readDeltas()
+{
+  byte block[5];
+
+  TEST_ASSERT_EQUAL_UINT8(sizeof(block), writePulseDeltas(block));
+  TEST_ASSERT_EQUAL_HEX8(0b11, block[0]);
+  delta[0] = (block[1] << 8) | block[2];
+  delta[1] = (block[3] << 8) | block[4];
+}
+
+static void pulse(uint8_t pin)
+{
+  simPinEdge(pin, LOW);
+  simPinEdge(pin, HIGH);
+}
+
+void setUp()
+{
+  readDeltas();
+  wakedFromISR0 = false;
+  wakedFromISR1 = false;
+}
+
+void tearDown()
+{
+}
+
+// Back to back edges, no time passes between them
+void test_every_falling_edge_counted()
+{
+  for (uint16_t i = 0; i < 1000; i++)
+  {
+    pulse(4);
+    if (i % 5 < 3)
+    {
+      pulse(5);
+    }
+  }
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(1000, delta[0]);
+  TEST_ASSERT_EQUAL_UINT16(600, delta[1]);
+}
+
+void test_overlapping_pulses()
+{
+  for (uint16_t i = 0; i < 500; i++)
+  {
+    simPinEdge(4, LOW);
+    simPinEdge(5, LOW);
+    simPinEdge(4, HIGH);
+    simPinEdge(5, HIGH);
+  }
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(500, delta[0]);
+  TEST_ASSERT_EQUAL_UINT16(500, delta[1]);
+}
+
+// Both inputs fell before the ISR ran, one interrupt serves both
+void test_edges_of_one_interrupt()
+{
+  PIND &= ~(bit(4) | bit(5));
+  PCINT2_vect();
+  simPinEdge(4, HIGH);
+  simPinEdge(5, HIGH);
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(1, delta[0]);
+  TEST_ASSERT_EQUAL_UINT16(1, delta[1]);
+}
+
+// Rising edges, an interrupt without level change and other pins of port D
+void test_no_double_count()
+{
+  simPinEdge(4, LOW);
+  TEST_ASSERT_FALSE(simPinEdge(4, LOW));
+  PCINT2_vect();
+  simPinEdge(4, HIGH);
+  PCINT2_vect();
+  pulse(2);
+  pulse(3);
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(1, delta[0]);
+  TEST_ASSERT_EQUAL_UINT16(0, delta[1]);
+}
+
+// Pulses at 1 kHz don't end the power down and none is lost
+void test_pulses_during_power_down()
+{
+  uint64_t start = simRealUs;
+
+  for (uint8_t i = 0; i < 30; i++)
+  {
+    simAddEdge(start + 1000000 + i * 1000, 4 + i % 2, LOW);
+    simAddEdge(start + 1000000 + i * 1000 + 200, 4 + i % 2, HIGH);
+  }
+  TEST_ASSERT_TRUE(powerDownPeriod(SLEEP_8S, true));
+  TEST_ASSERT_GREATER_OR_EQUAL(start + 8000000, simRealUs);
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(15, delta[0]);
+  TEST_ASSERT_EQUAL_UINT16(15, delta[1]);
+}
+
+// Deltas above 16 bit are carried over to the next uplink
+void test_carry_over()
+{
+  for (uint32_t i = 0; i < 70000; i++)
+  {
+    pulse(5);
+  }
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(0, delta[0]);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, delta[1]);
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(70000 - 0xFFFF, delta[1]);
+  readDeltas();
+  TEST_ASSERT_EQUAL_UINT16(0, delta[1]);
+}
+
+int main()
+{
+  simQuiet = true;
+  simInit();
+  EEPROM.data[CFG_PULSE_COUNTERS] = 0b11;
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_every_falling_edge_counted);
+  RUN_TEST(test_overlapping_pulses);
+  RUN_TEST(test_edges_of_one_interrupt);
+  RUN_TEST(test_no_double_count);
+  RUN_TEST(test_pulses_during_power_down);
+  RUN_TEST(test_carry_over);
+  return UNITY_END();
+}
@@ -0,0 +1,162 @@
+// Window statistics: intermediate samples between the uplinks and the summary that
+// replaces the point values in the uplink.
+// Run with: pio test -e native
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <lmic.h>
+#include <unity.h>
+#include "sim.h"
+
+// Offset of STATS_INTERVAL in configData_t (main.cpp), the sleep time is 300 s
+#define CFG_STATS_INTERVAL 93
+#define STATS_INTERVAL 60
+#define SAMPLES 5 // Per window at least 4 intermediate samples and the sample of the uplink
+
+#define DATA_FPORT 1
+
+// _PayloadBlock in main.cpp
+#define BLOCK_BAT 0x01
+#define BLOCK_BME 0x02
+#define BLOCK_DS 0x04
+#define BLOCK_STATS 0x20
+#define BLOCK_STATUS 0x40
+
+#define SENSOR_DS 1 // _Sensor in main.cpp
+
+// Values of the simulated sensors
+#define BME_TEMP 2150
+#define BME_HUMI 4500
+#define BME_PRESS 1013
+#define DS_TEMP 1875
+
+// Defined in main.cpp
+void setup();
+void loop();
+
+static uint8_t frame[MAX_LEN_PAYLOAD];
+static uint8_t frameLen;
+static uint16_t uplinks;
+
+static void onUplink(uint8_t port, uint32_t fcnt, uint8_t attempts, const uint8_t *data, uint8_t len,
+                     uint8_t txrxFlags)
+{
+  if (port == DATA_FPORT)
+  {
+    memcpy(frame, data, len);
+    frameLen = len;
+    uplinks++;
+  }
+}
+
+// The loop() that completes an uplink also sleeps and queues the next one,
+// so a change of the sensors shows in the uplink after the next.
+static void nextUplink()
+{
+  uint16_t end = uplinks + 1;
+
+  while (uplinks < end)
+  {
+    loop();
+  }
+}
+
+static int16_t int16(uint8_t pos)
+{
+  return (int16_t)((frame[pos] << 8) | frame[pos + 1]);
+}
+
+// Position of a block in the frame, the blocks before it are skipped
+static uint8_t blockPos(uint8_t block)
+{
+  uint8_t content = frame[2];
+  uint8_t pos = 3;
+
+  pos += block > BLOCK_BAT && (content & BLOCK_BAT) ? 2 : 0;
+  pos += block > BLOCK_BME && (content & BLOCK_BME) ? 6 : 0;
+  pos += block > BLOCK_DS && (content & BLOCK_DS) ? 1 + frame[pos] * 2 : 0;
+  if (block > BLOCK_STATS && (content & BLOCK_STATS))
+  {
+    pos += 2 + (frame[pos + 1] & BLOCK_BME ? 18 : 0) + (frame[pos + 1] & BLOCK_DS ? 6 : 0);
+  }
+  return pos;
+}
+
+static void assertStat(uint8_t pos, int16_t value)
+{
+  TEST_ASSERT_EQUAL_INT16(value, int16(pos));
+  TEST_ASSERT_EQUAL_INT16(value, int16(pos + 2));
+  TEST_ASSERT_EQUAL_INT16(value, int16(pos + 4));
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// The uplink carries the battery and the summary, not the point values of the sensors
+void test_summary_replaces_point_values()
+{
+  nextUplink();
+  TEST_ASSERT_EQUAL_HEX8(BLOCK_BAT | BLOCK_STATS, frame[2]);
+
+  uint8_t pos = blockPos(BLOCK_STATS);
+  TEST_ASSERT_GREATER_OR_EQUAL(SAMPLES, frame[pos]);
+  TEST_ASSERT_EQUAL_HEX8(BLOCK_BME | BLOCK_DS, frame[pos + 1]);
+  assertStat(pos + 2, BME_TEMP);
+  assertStat(pos + 8, BME_HUMI);
+  assertStat(pos + 14, BME_PRESS);
+  assertStat(pos + 20, DS_TEMP);
+  TEST_ASSERT_EQUAL_UINT8(pos + 26, frameLen);
+}
+
+// Only the readouts of the uplinks count the failures of a sensor and its backoff,
+// the intermediate samples of a failing sensor are just left out of the summary
+void test_intermediate_samples_keep_health()
+{
+  simDsConnect(0, false);
+  nextUplink();
+  for (uint8_t fails = 1; fails <= 3; fails++)
+  {
+    nextUplink();
+    TEST_ASSERT_TRUE(frame[2] & BLOCK_STATUS);
+    // Bit 7: The third failure starts a backoff of one readout
+    TEST_ASSERT_EQUAL_HEX8(fails < 3 ? fails : 0x80 | fails, frame[blockPos(BLOCK_STATUS) + SENSOR_DS]);
+    TEST_ASSERT_EQUAL_HEX8(BLOCK_BME, frame[blockPos(BLOCK_STATS) + 1]);
+  }
+
+  // The backoff is spent by the next uplink, not by the intermediate samples before it
+  nextUplink();
+  TEST_ASSERT_EQUAL_HEX8(3, frame[blockPos(BLOCK_STATUS) + SENSOR_DS]);
+
+  // The fourth failure (queued before the probe is back) doubles the backoff,
+  // then the probe is skipped for two uplinks
+  simDsConnect(0, true);
+  const uint8_t status[] = {0x84, 0x84, 0x04};
+  for (uint8_t i = 0; i < sizeof(status); i++)
+  {
+    nextUplink();
+    TEST_ASSERT_EQUAL_HEX8(status[i], frame[blockPos(BLOCK_STATUS) + SENSOR_DS]);
+  }
+  nextUplink();
+  TEST_ASSERT_FALSE(frame[2] & BLOCK_STATUS);
+  TEST_ASSERT_EQUAL_HEX8(BLOCK_BAT | BLOCK_STATS, frame[2]);
+}
+
+int main()
+{
+  simQuiet = true;
+  simInit();
+  EEPROM.data[CFG_STATS_INTERVAL] = STATS_INTERVAL;
+  simAddDs(false, DS_TEMP);
+  simOnUplink = onUplink;
+  setup();
+  nextUplink();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_summary_replaces_point_values);
+  RUN_TEST(test_intermediate_samples_keep_health);
+  return UNITY_END();
+}
@@ -0,0 +1,679 @@
+// Cycle-accurate benchmark of the AVR firmware image in simavr. The SX1276 is
+// stubbed on the SPI bus, the BME280 on the TWI, the battery on ADC0.
+// Reports the cycles per phase of every uplink and the stack high-water mark.
+// Build and run with: make bench (see README.md, "AVR benchmark")
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <libelf.h>
+#include <gelf.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_time.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+#include "avr_twi.h"
+#include "avr_adc.h"
+#include "avr_eeprom.h"
+
+#define F_CPU 8000000
+#define EEPROM_SIZE 1024
+#define DATA_OFFSET 0x800000 // Data space addresses in the ELF
+
+// Registers in data space (ATmega328P datasheet 30)
+#define REG_SMCR 0x53
+#define REG_TIMSK0 0x6E
+#define SMCR_PWR_DOWN (2 << 1)
+
+#define RAMEND_328P 0x8FF // Initial stack pointer
+
+// SX1276 registers used by LMIC
+#define SX_FIFO 0x00
+#define SX_OPMODE 0x01
+#define SX_FIFO_ADDR_PTR 0x0D
+#define SX_IRQ_FLAGS 0x12
+#define SX_MODEM_CONFIG1 0x1D
+#define SX_MODEM_CONFIG2 0x1E
+#define SX_SYMB_TIMEOUT 0x1F
+#define SX_PREAMBLE_MSB 0x20
+#define SX_PREAMBLE_LSB 0x21
+#define SX_PAYLOAD_LENGTH 0x22
+#define SX_MODEM_CONFIG3 0x26
+#define SX_RSSI_WIDEBAND 0x2C
+#define SX_VERSION 0x42
+
+#define SX_OPMODE_LORA 0x80
+#define SX_MODE_TX 3
+#define SX_MODE_RX_SINGLE 6
+#define SX_IRQ_TXDONE 0x08
+#define SX_IRQ_RXTIMEOUT 0x80
+
+#define BME_ADDR 0x76
+
+// Time is accounted to the first category that applies
+enum _Category
+{
+  CAT_CRYPTO,      // In os_aes()
+  CAT_SENSOR,      // Power phase ADC, TWI or 1-Wire
+  CAT_ENCODE,      // In do_send(), do_send_event() or do_send_backlog()
+  CAT_BOOT,        // From reset to the first send job
+  CAT_SLEEP_ENTRY, // Power phase sleep, CPU running
+  CAT_SLEEP,       // CPU sleeping
+  CAT_AWAKE,       // Everything else: LMIC, radio, delays
+  CAT_NUM
+};
+
+static const char *catNames[CAT_NUM] = {"crypto", "sensor", "encode", "boot", "sleep entry", "sleep", "awake"};
+
+// _PowerPhase in main.cpp
+enum
+{
+  PHASE_SLEEP,
+  PHASE_AWAKE,
+  PHASE_ADC,
+  PHASE_TWI,
+  PHASE_ONEWIRE,
+  PHASE_ENCODE
+};
+
+// A function of the firmware, active from its entry until the stack pointer
+// is above the one at the entry (returned)
+typedef struct
+{
+  const char *name;
+  uint8_t category;
+  uint32_t pc;
+  uint16_t sp;
+  bool active;
+} region_t;
+
+static region_t regions[] = {
+    {"os_aes", CAT_CRYPTO},
+    {"do_send", CAT_ENCODE},
+    {"do_send_event", CAT_ENCODE},
+    {"do_send_backlog", CAT_ENCODE},
+};
+#define REGION_NUM (sizeof(regions) / sizeof(regions[0]))
+
+static avr_t *avr;
+static uint32_t phaseAddr;   // powerPhaseNow
+static uint32_t heapStart;   // __heap_start, end of .data and .bss
+static bool booted;          // First send job entered
+
+static avr_cycle_count_t cycles[CAT_NUM];
+static avr_cycle_count_t uplinkCycles[CAT_NUM];
+static uint16_t minSP = 0xFFFF;
+static uint16_t uplinkMinSP = 0xFFFF;
+static unsigned uplinks;
+static unsigned maxUplinks = 3;
+static uint16_t adcMilliVolts = 752; // 700 at the 1.1 V reference
+static bool bmePresent = true;
+
+// ---------------------------------------------------------------------------
+// Symbols
+
+// True if the ELF symbol is name, a C++ function name(...) or an LTO clone of both
+static bool symbolIs(const char *sym, const char *name)
+{
+  size_t len = strlen(name);
+  char mangled[64];
+
+  if (strncmp(sym, name, len) == 0 && (sym[len] == '\0' || sym[len] == '.'))
+  {
+    return true;
+  }
+  snprintf(mangled, sizeof(mangled), "_Z%zu%s", len, name);
+  return strncmp(sym, mangled, strlen(mangled)) == 0;
+}
+
+static bool readSymbols(const char *file)
+{
+  Elf *elf;
+  Elf_Scn *scn = NULL;
+  int fd = open(file, O_RDONLY);
+
+  if (fd < 0 || elf_version(EV_CURRENT) == EV_NONE || !(elf = elf_begin(fd, ELF_C_READ, NULL)))
+  {
+    return false;
+  }
+  while ((scn = elf_nextscn(elf, scn)))
+  {
+    GElf_Shdr shdr;
+    Elf_Data *data;
+
+    if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB || !(data = elf_getdata(scn, NULL)))
+    {
+      continue;
+    }
+    for (size_t i = 0; i < shdr.sh_size / shdr.sh_entsize; i++)
+    {
+      GElf_Sym sym;
+      const char *name;
+
+      if (!gelf_getsym(data, i, &sym) || !(name = elf_strptr(elf, shdr.sh_link, sym.st_name)))
+      {
+        continue;
+      }
+      if (GELF_ST_TYPE(sym.st_info) == STT_FUNC)
+      {
+        for (size_t r = 0; r < REGION_NUM; r++)
+        {
+          if (!regions[r].pc && symbolIs(name, regions[r].name))
+          {
+            regions[r].pc = sym.st_value;
+          }
+        }
+      }
+      else if (symbolIs(name, "powerPhaseNow"))
+      {
+        phaseAddr = sym.st_value - DATA_OFFSET;
+      }
+      else if (strcmp(name, "__heap_start") == 0)
+      {
+        heapStart = sym.st_value - DATA_OFFSET;
+      }
+    }
+  }
+  elf_end(elf);
+  close(fd);
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// SX1276 stub: register file, FIFO, TX done after the airtime, RX timeout
+// after the symbol timeout. There is never a downlink.
+
+static uint8_t sxRegs[0x80];
+static uint8_t sxFifo[256];
+static int spiIndex = -1; // Byte in the current transfer, -1 = NSS high
+static uint8_t spiAddr;
+static bool spiWrite;
+static avr_irq_t *spiIn;
+static avr_irq_t *dio0;
+static avr_irq_t *dio1;
+
+static double sxSymbolUs()
+{
+  static const double bwKHz[] = {7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125, 250, 500};
+  uint8_t bw = sxRegs[SX_MODEM_CONFIG1] >> 4;
+
+  return (1 << (sxRegs[SX_MODEM_CONFIG2] >> 4)) * 1000.0 / bwKHz[bw < 10 ? bw : 7];
+}
+
+// Time on air of the payload in the FIFO (SX1276 datasheet 4.1.1.7)
+static uint32_t sxAirtimeUs()
+{
+  int sf = sxRegs[SX_MODEM_CONFIG2] >> 4;
+  int cr = (sxRegs[SX_MODEM_CONFIG1] >> 1) & 7;
+  int ih = sxRegs[SX_MODEM_CONFIG1] & 1;
+  int crc = (sxRegs[SX_MODEM_CONFIG2] >> 2) & 1;
+  int de = (sxRegs[SX_MODEM_CONFIG3] >> 3) & 1;
+  int preamble = (sxRegs[SX_PREAMBLE_MSB] << 8) | sxRegs[SX_PREAMBLE_LSB];
+  double n = ceil((8.0 * sxRegs[SX_PAYLOAD_LENGTH] - 4 * sf + 28 + 16 * crc - 20 * ih) / (4 * (sf - 2 * de)));
+
+  return (uint32_t)((preamble + 4.25 + 8 + (n > 0 ? n * (cr + 4) : 0)) * sxSymbolUs());
+}
+
+static avr_cycle_count_t sxIrq(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+  uint8_t flag = (uint8_t)(uintptr_t)param;
+
+  sxRegs[SX_IRQ_FLAGS] |= flag;
+  avr_raise_irq(flag == SX_IRQ_TXDONE ? dio0 : dio1, 1);
+  if (flag == SX_IRQ_TXDONE)
+  {
+    uplinks++;
+  }
+  return 0;
+}
+
+static void sxSetOpMode(uint8_t value)
+{
+  avr_cycle_timer_cancel(avr, sxIrq, (void *)(uintptr_t)SX_IRQ_TXDONE);
+  avr_cycle_timer_cancel(avr, sxIrq, (void *)(uintptr_t)SX_IRQ_RXTIMEOUT);
+  sxRegs[SX_OPMODE] = value;
+  if (!(value & SX_OPMODE_LORA))
+  {
+    return;
+  }
+  if ((value & 7) == SX_MODE_TX)
+  {
+    avr_cycle_timer_register_usec(avr, sxAirtimeUs(), sxIrq, (void *)(uintptr_t)SX_IRQ_TXDONE);
+  }
+  else if ((value & 7) == SX_MODE_RX_SINGLE)
+  {
+    uint16_t symbols = ((sxRegs[SX_MODEM_CONFIG2] & 3) << 8) | sxRegs[SX_SYMB_TIMEOUT];
+    avr_cycle_timer_register_usec(avr, (uint32_t)(symbols * sxSymbolUs()), sxIrq, (void *)(uintptr_t)SX_IRQ_RXTIMEOUT);
+  }
+}
+
+static void sxWrite(uint8_t reg, uint8_t value)
+{
+  switch (reg)
+  {
+  case SX_FIFO:
+    sxFifo[sxRegs[SX_FIFO_ADDR_PTR]++] = value;
+    break;
+  case SX_OPMODE:
+    sxSetOpMode(value);
+    break;
+  case SX_IRQ_FLAGS:
+    sxRegs[SX_IRQ_FLAGS] &= ~value;
+    avr_raise_irq(dio0, (sxRegs[SX_IRQ_FLAGS] & SX_IRQ_TXDONE) != 0);
+    avr_raise_irq(dio1, (sxRegs[SX_IRQ_FLAGS] & SX_IRQ_RXTIMEOUT) != 0);
+    break;
+  default:
+    sxRegs[reg] = value;
+  }
+}
+
+static uint8_t sxRead(uint8_t reg)
+{
+  switch (reg)
+  {
+  case SX_FIFO:
+    return sxFifo[sxRegs[SX_FIFO_ADDR_PTR]++];
+  case SX_VERSION:
+    return 0x12;
+  case SX_RSSI_WIDEBAND:
+    return rand(); // LMIC seeds its random numbers from the noise
+  default:
+    return sxRegs[reg];
+  }
+}
+
+static void nssChanged(avr_irq_t *irq, uint32_t value, void *param)
+{
+  spiIndex = value ? -1 : 0;
+}
+
+// Called with every byte shifted out, the reply is shifted in at the same time
+static void spiByte(avr_irq_t *irq, uint32_t value, void *param)
+{
+  uint8_t reply = 0;
+
+  if (spiIndex < 0)
+  {
+    return;
+  }
+  if (spiIndex == 0)
+  {
+    spiAddr = value & 0x7F;
+    spiWrite = value & 0x80;
+  }
+  else
+  {
+    if (spiWrite)
+    {
+      sxWrite(spiAddr, value);
+    }
+    else
+    {
+      reply = sxRead(spiAddr);
+    }
+    // The FIFO is accessed through its pointer, all other registers increment
+    if (spiAddr != SX_FIFO)
+    {
+      spiAddr = (spiAddr + 1) & 0x7F;
+    }
+  }
+  spiIndex++;
+  avr_raise_irq(spiIn, reply);
+}
+
+// ---------------------------------------------------------------------------
+// BME280 stub: calibration of the native simulation, measures 21.50 °C, 45 %
+// and 1013.25 hPa. The measurement is done at once, STATUS is never busy.
+
+static uint8_t bmeRegs[256];
+static bool bmeSelected;
+static int bmeIndex;
+static uint8_t bmePtr;
+static avr_irq_t *twiIn;
+
+static const uint8_t bmeCalibTP[] = {
+    0x45, 0x6F, 0x6F, 0x68, 0x32, 0x00, 0x7F, 0x92, 0x03, 0xD7, 0xD0, 0x0B, 0xB9,
+    0x1F, 0xA8, 0xFF, 0xF9, 0xFF, 0xAC, 0x26, 0x0A, 0xD8, 0xBD, 0x10, 0x00, 0x4B};
+static const uint8_t bmeCalibH[] = {0x60, 0x01, 0x00, 0x15, 0x22, 0x03, 0x1E};
+static const uint8_t bmeData[] = {0x4A, 0xE3, 0x00, 0x7F, 0xBC, 0xD0, 0x75, 0x5B};
+
+static void bmeInit()
+{
+  memcpy(bmeRegs + 0x88, bmeCalibTP, sizeof(bmeCalibTP));
+  bmeRegs[0xA1] = 0x4B; // dig_H1
+  memcpy(bmeRegs + 0xE1, bmeCalibH, sizeof(bmeCalibH));
+  memcpy(bmeRegs + 0xF7, bmeData, sizeof(bmeData));
+  bmeRegs[0xD0] = 0x60; // Chip ID
+}
+
+static void twiMessage(avr_irq_t *irq, uint32_t value, void *param)
+{
+  avr_twi_msg_irq_t v;
+
+  v.u.v = value;
+  if (v.u.twi.msg & TWI_COND_STOP)
+  {
+    bmeSelected = false;
+  }
+  if (v.u.twi.msg & TWI_COND_START)
+  {
+    bmeSelected = bmePresent && (v.u.twi.addr >> 1) == BME_ADDR;
+    bmeIndex = 0;
+    if (bmeSelected)
+    {
+      avr_raise_irq(twiIn, avr_twi_irq_msg(TWI_COND_ACK, v.u.twi.addr, 1));
+    }
+  }
+  if (!bmeSelected)
+  {
+    return;
+  }
+  if (v.u.twi.msg & TWI_COND_WRITE)
+  {
+    // Register address, then register/value pairs
+    if (bmeIndex++ % 2 == 0)
+    {
+      bmePtr = v.u.twi.data;
+    }
+    else if (bmePtr < 0xF2 || bmePtr > 0xF5 || bmePtr == 0xF3)
+    {
+      // Only ctrl_hum, ctrl_meas and config are writable
+    }
+    else
+    {
+      bmeRegs[bmePtr] = v.u.twi.data;
+    }
+    avr_raise_irq(twiIn, avr_twi_irq_msg(TWI_COND_ACK, v.u.twi.addr, 1));
+  }
+  if (v.u.twi.msg & TWI_COND_READ)
+  {
+    avr_raise_irq(twiIn, avr_twi_irq_msg(TWI_COND_READ, v.u.twi.addr, bmeRegs[bmePtr++]));
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Accounting
+
+// The pins of main.cpp: LORA_CS D10 = PB2, LORA_DIO0 D8 = PB0, LORA_DIO1 D7 = PD7, ONEWIREBUS D6 = PD6
+static avr_irq_t *pinIrq(char port, int pin)
+{
+  return avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), pin);
+}
+
+// Sleeping takes no real time
+static void noSleep(avr_t *avr, avr_cycle_count_t howLong)
+{
+}
+
+static uint8_t category(uint16_t sp)
+{
+  uint8_t phase = phaseAddr ? avr->data[phaseAddr] : PHASE_AWAKE;
+  bool inRegion[CAT_NUM] = {false};
+
+  for (size_t r = 0; r < REGION_NUM; r++)
+  {
+    region_t *region = &regions[r];
+
+    if (!region->active && region->pc && avr->pc == region->pc)
+    {
+      region->active = true;
+      region->sp = sp;
+      booted |= region->category == CAT_ENCODE;
+    }
+    else if (region->active && sp > region->sp)
+    {
+      region->active = false;
+    }
+    inRegion[region->category] |= region->active;
+  }
+
+  if (avr->state == cpu_Sleeping)
+  {
+    return CAT_SLEEP;
+  }
+  if (inRegion[CAT_CRYPTO])
+  {
+    return CAT_CRYPTO;
+  }
+  if (phase == PHASE_ADC || phase == PHASE_TWI || phase == PHASE_ONEWIRE)
+  {
+    return CAT_SENSOR;
+  }
+  if (inRegion[CAT_ENCODE])
+  {
+    return CAT_ENCODE;
+  }
+  if (!booted)
+  {
+    return CAT_BOOT;
+  }
+  return phase == PHASE_SLEEP ? CAT_SLEEP_ENTRY : CAT_AWAKE;
+}
+
+static double cyclesToMs(avr_cycle_count_t c)
+{
+  return c * 1000.0 / F_CPU;
+}
+
+static void printUplink()
+{
+  printf("[bench] %10.3f s #%u:", avr->cycle / (double)F_CPU, uplinks);
+  for (int i = 0; i < CAT_NUM; i++)
+  {
+    if (uplinkCycles[i] && i != CAT_SLEEP)
+    {
+      printf(" %s %llu (%.2f ms)", catNames[i], (unsigned long long)uplinkCycles[i], cyclesToMs(uplinkCycles[i]));
+    }
+  }
+  printf(", stack %u bytes\n", RAMEND_328P - uplinkMinSP);
+  memset(uplinkCycles, 0, sizeof(uplinkCycles));
+  uplinkMinSP = 0xFFFF;
+}
+
+static void printSummary(const char *reason)
+{
+  avr_cycle_count_t active = 0;
+
+  for (int i = 0; i < CAT_NUM; i++)
+  {
+    if (i != CAT_SLEEP)
+    {
+      active += cycles[i];
+    }
+  }
+
+  printf("\n== Benchmark end: %s ==\n", reason);
+  printf("Time          %12.3f s\n", avr->cycle / (double)F_CPU);
+  printf("Uplinks       %8u\n", uplinks);
+  printf("%-12s %14s %12s\n", "Phase", "cycles", "ms");
+  for (int i = 0; i < CAT_NUM; i++)
+  {
+    printf("  %-11s %14llu %12.3f\n", catNames[i], (unsigned long long)cycles[i], cyclesToMs(cycles[i]));
+  }
+  printf("Active        %14llu %12.3f\n", (unsigned long long)active, cyclesToMs(active));
+  if (uplinks)
+  {
+    printf("Active/uplink %14llu %12.3f\n", (unsigned long long)(active / uplinks), cyclesToMs(active / uplinks));
+  }
+  printf("Stack high-water mark %u bytes", RAMEND_328P - minSP);
+  if (heapStart)
+  {
+    printf(", %u bytes free above .data/.bss", minSP > heapStart ? minSP - heapStart : 0);
+  }
+  printf("\n");
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options] firmware.elf\n"
+          "  -e FILE   EEPROM image with a valid config (e.g. written by the native simulation)\n"
+          "  -n N      Stop after N uplinks (default 3)\n"
+          "  -t S      Stop after S simulated seconds (default 3600)\n"
+          "  -a ADC    Raw ADC reading of the battery voltage (default 700)\n"
+          "  -B        No BME280\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  elf_firmware_t firmware = {{0}};
+  const char *eepromFile = NULL;
+  double limitS = 3600;
+  uint8_t eeprom[EEPROM_SIZE];
+  uint8_t timsk0 = 0;
+  bool timer0Masked = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:n:t:a:Bh")) != -1)
+  {
+    switch (opt)
+    {
+    case 'e':
+      eepromFile = optarg;
+      break;
+    case 'n':
+      maxUplinks = atoi(optarg);
+      break;
+    case 't':
+      limitS = atof(optarg);
+      break;
+    case 'a':
+      adcMilliVolts = atoi(optarg) * 1100 / 1024;
+      break;
+    case 'B':
+      bmePresent = false;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc || !eepromFile)
+  {
+    usage(argv[0]);
+  }
+
+  FILE *f = fopen(eepromFile, "rb");
+  if (!f || fread(eeprom, sizeof(eeprom), 1, f) != 1)
+  {
+    fprintf(stderr, "Can't read %s\n", eepromFile);
+    return 1;
+  }
+  fclose(f);
+
+  if (elf_read_firmware(argv[optind], &firmware) || !readSymbols(argv[optind]))
+  {
+    fprintf(stderr, "Can't read %s\n", argv[optind]);
+    return 1;
+  }
+  if (!phaseAddr)
+  {
+    fprintf(stderr, "No symbol powerPhaseNow, the sensor and sleep phases are not reported\n");
+  }
+  for (size_t r = 0; r < REGION_NUM; r++)
+  {
+    if (!regions[r].pc)
+    {
+      fprintf(stderr, "No symbol %s, %s is not reported\n", regions[r].name, catNames[regions[r].category]);
+    }
+  }
+
+  strcpy(firmware.mmcu, "atmega328p");
+  firmware.frequency = F_CPU;
+  avr = avr_make_mcu_by_name(firmware.mmcu);
+  if (!avr)
+  {
+    fprintf(stderr, "simavr has no %s core\n", firmware.mmcu);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->vcc = avr->avcc = 3300;
+  avr->sleep = noSleep;
+
+  avr_eeprom_desc_t ee = {.ee = eeprom, .offset = 0, .size = sizeof(eeprom)};
+  avr_ioctl(avr, AVR_IOCTL_EEPROM_SET, &ee);
+
+  // SX1276 on the SPI, chip select and DIO pins
+  spiIn = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT), spiByte, NULL);
+  avr_irq_register_notify(pinIrq('B', 2), nssChanged, NULL);
+  dio0 = pinIrq('B', 0);
+  dio1 = pinIrq('D', 7);
+  avr_raise_irq(dio0, 0);
+  avr_raise_irq(dio1, 0);
+
+  // BME280 on the TWI
+  bmeInit();
+  twiIn = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), twiMessage, NULL);
+
+  // Battery divider on ADC0, 1-Wire bus with pull-up and no probes
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0), adcMilliVolts);
+  avr_raise_irq(pinIrq('D', 6), 1);
+
+  while (true)
+  {
+    uint16_t sp = avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+    uint8_t cat = category(sp);
+    avr_cycle_count_t start = avr->cycle;
+    unsigned lastUplinks = uplinks;
+    int state = avr_run(avr);
+
+    cycles[cat] += avr->cycle - start;
+    uplinkCycles[cat] += avr->cycle - start;
+    if (sp < minSP)
+    {
+      minSP = sp;
+    }
+    if (sp < uplinkMinSP)
+    {
+      uplinkMinSP = sp;
+    }
+
+    // simavr doesn't stop the Timer0 clock in power down, its overflow
+    // interrupt would wake the MCU every 2 ms
+    if (avr->state == cpu_Sleeping && !timer0Masked && (avr->data[REG_SMCR] & 0x0E) == SMCR_PWR_DOWN)
+    {
+      timsk0 = avr->data[REG_TIMSK0];
+      avr->data[REG_TIMSK0] = 0;
+      timer0Masked = true;
+    }
+    else if (avr->state != cpu_Sleeping && timer0Masked)
+    {
+      avr->data[REG_TIMSK0] = timsk0;
+      timer0Masked = false;
+    }
+
+    if (uplinks != lastUplinks)
+    {
+      printUplink();
+      if (maxUplinks && uplinks >= maxUplinks)
+      {
+        printSummary("uplinks reached");
+        break;
+      }
+    }
+    if (state == cpu_Done || state == cpu_Crashed)
+    {
+      printSummary(state == cpu_Done ? "MCU stopped" : "MCU crashed");
+      return 1;
+    }
+    if (avr->cycle >= limitS * F_CPU)
+    {
+      // Fewer uplinks than asked for, the firmware hangs or never sends
+      printSummary("time limit");
+      return maxUplinks ? 1 : 0;
+    }
+  }
+  return 0;
+}
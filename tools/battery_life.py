@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+# Battery life projection of a node configuration.
+#
+# Reads a config in the hex format of the config menu (with or without the
+# checksum) and projects the charge per day and the battery life. The schedule
+# follows the firmware: periodic cycles, interrupts with coalescing and fast path,
+# confirmed uplinks with retries, backlog, window statistics and diagnostics
+# frames. The currents are those of timeCurrent[] in src/main.cpp, the timings
+# and batteries are in energy_model.json. See README.md, "Battery life".
+#
+#   python tools/battery_life.py 01E0930400...
+#   python tools/battery_life.py config.txt --itr0 20 --sf 9 --ack-loss 0.1
+#   python tools/battery_life.py config.txt --diag 2803000008C5... --nodes 1000
+
+import argparse
+import json
+import math
+import os
+import re
+import struct
+import sys
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MAIN = os.path.join(ROOT, "src", "main.cpp")
+MODEL = os.path.join(ROOT, "tools", "energy_model.json")
+
+# Field types of configData_t
+TYPES = {"uint8_t": "B", "int8_t": "b", "uint16_t": "H", "int16_t": "h", "uint32_t": "I", "u4_t": "I", "u1_t": "s"}
+
+# Blocks of the payload, see _PayloadBlock and _DiagBlock in main.cpp
+BLOCK_BAT = 0x01
+BLOCK_BME = 0x02
+BLOCK_DS = 0x04
+DIAG_STACK = 0x01
+DIAG_CYCLE = 0x02
+
+LORAWAN_OVERHEAD = 13  # MHDR, FHDR, FPort and MIC
+TXCONF_ATTEMPTS = 8  # LMIC
+DAY = 86400
+
+
+def read_source():
+    with open(MAIN) as f:
+        return f.read()
+
+
+def define(source, name):
+    return int(re.search(rf"^#define {name} (\d+)", source, re.MULTILINE).group(1))
+
+
+def config_layout(source):
+    """[(name, struct format)] of configData_t"""
+    body = re.search(r"typedef struct\s*\{([^}]*)\}\s*configData_t;", source).group(1)
+    layout = []
+    for match in re.finditer(r"^\s*(\w+)\s+(\w+)(?:\[(\d+)\])?;", body, re.MULTILINE):
+        fmt = TYPES[match.group(1)]
+        layout.append((match.group(2), match.group(3) + fmt if match.group(3) else fmt))
+    return layout
+
+
+def currents(source, overrides):
+    """Current in µA per name of timeCurrent[] (PHASE_SLEEP, ..., TIME_RX)"""
+    body = re.search(r"timeCurrent\[TIME_NUM\] PROGMEM = \{(.*?)\};", source, re.DOTALL).group(1)
+    result = {name: int(value) for value, name in re.findall(r"(\d+),\s*// (\w+)", body)}
+    result.update(overrides)
+    return result
+
+
+def read_config(text, layout):
+    text = re.sub(r"\s", "", open(text).read() if os.path.exists(text) else text)
+    size = struct.calcsize("<" + "".join(fmt for _, fmt in layout))
+    if len(text) not in (size * 2, size * 2 + 8):
+        sys.exit(f"Config has {len(text) // 2} bytes, expected {size} or {size + 4} with checksum")
+    if len(text) > size * 2 and zlib.crc32(text[: size * 2].encode()) != int(text[size * 2:], 16):
+        print("WARNING checksum mismatch")
+    values = struct.unpack("<" + "".join(fmt for _, fmt in layout), bytes.fromhex(text[: size * 2]))
+    return dict(zip([name for name, _ in layout], values))
+
+
+def read_diag(frames):
+    """Mean of the DIAG_CYCLE blocks of diagnostics frames (FPort 4, hex)"""
+    names = ["awake", "battery", "bme", "ds", "encode", "tx", "rx"]
+    sums = {}
+    counts = {}
+    for frame in frames:
+        data = bytes.fromhex(frame)
+        pos = 2
+        if data[1] & DIAG_STACK:
+            pos += 2
+        if not data[1] & DIAG_CYCLE:
+            continue
+        values = list(struct.unpack_from(">7HBHI", data, pos))
+        cycle = dict(zip(names + ["attempts", "sleep", "charge"], values))
+        for name, value in cycle.items():
+            # Skipped sensors have no time
+            if value or name not in ("battery", "bme", "ds"):
+                sums[name] = sums.get(name, 0) + value
+                counts[name] = counts.get(name, 0) + 1
+    return {name: sums[name] / counts[name] for name in sums}
+
+
+def airtime_ms(payload, sf):
+    """LoRa airtime at 125 kHz, CR 4/5, 8 symbols preamble, explicit header and CRC"""
+    tsym = (2 ** sf) / 125.0
+    de = 1 if sf >= 11 else 0
+    bits = 8 * (payload + LORAWAN_OVERHEAD) - 4 * sf + 28 + 16
+    symbols = 8 + max(math.ceil(bits / (4 * (sf - 2 * de))) * 5, 0)
+    return (8 + 4.25) * tsym + symbols * tsym
+
+
+def sample_size(profile, probes, bme):
+    size = 0
+    if profile & BLOCK_BAT:
+        size += 2
+    if profile & BLOCK_BME and bme:
+        size += 6
+    if profile & BLOCK_DS and probes:
+        size += 1 + 2 * probes
+    return size
+
+
+def project(cfg, args, timing, amps, source):
+    """Charge in µC per day per entry of amps and the uplink counts"""
+    charge = {name: 0.0 for name in amps}
+    counts = {"periodic": 0.0, "interrupt": 0.0, "event": 0.0, "catch-up": 0.0, "diag": 0.0, "attempts": 0.0}
+
+    def awake(ms, name="PHASE_AWAKE"):
+        charge[name] += ms * amps[name] / 1000
+
+    def sensors(profile, times=1.0):
+        if profile & BLOCK_BAT:
+            awake(times * timing["battery_ms"] / max(cfg["BAT_INTERVAL"], 1), "PHASE_ADC")
+        if profile & BLOCK_BME and not args.no_bme:
+            awake(times * timing["bme_ms"], "PHASE_TWI")
+        if profile & BLOCK_DS and args.ds_probes:
+            awake(times * timing["ds_ms"], "PHASE_ONEWIRE")
+
+    def uplinks(rate, payload, confirmed):
+        """rate uplinks per day, confirmed is the fraction of confirmed uplinks"""
+        tx = args.tx_ms or airtime_ms(payload, args.sf)
+        retries = min(cfg["CONFIRM_RETRIES"], TXCONF_ATTEMPTS - 1)
+        loss = args.ack_loss
+        attempts = sum(loss ** k for k in range(retries + 1))
+        nack = loss ** (retries + 1)
+
+        # Unconfirmed: one TX, both receive windows. Confirmed: the attempts without
+        # ACK listen in both windows, the one with ACK only in the first.
+        tx_count = rate * (1 - confirmed + confirmed * attempts)
+        rx = rate * ((1 - confirmed) * timing["rx_ms"] + confirmed * (
+            (attempts - (1 - nack)) * timing["rx_ms"] + (1 - nack) * timing["rx_ack_ms"]))
+        retry_wait = rate * confirmed * (attempts - 1) * timing["retry_wait_ms"]
+
+        counts["attempts"] += tx_count
+        awake(rate * timing["wake_ms"] + tx_count * tx + rx + retry_wait)
+        awake(rate * timing["encode_ms"], "PHASE_ENCODE")
+        charge["TIME_TX"] += tx_count * tx * amps["TIME_TX"] / 1000
+        charge["TIME_RX"] += rx * amps["TIME_RX"] / 1000
+        return rate * confirmed * nack
+
+    # Sleep with the mean random send delay, the awake time is small against it
+    sleep = cfg["SLEEPTIME"]
+    if sleep and not cfg["TX_SLOTTED"]:
+        sleep += (define(source, "LORA_MAX_RANDOM_SEND_DELAY") - 1) / 2
+
+    # Interrupts within the coalescing window are sent in one uplink
+    itr = (args.itr0 + args.itr1) if cfg["WAKEUP_BY_INTERRUPT_PINS"] else 0
+    itr_uplinks = itr / (1 + itr * cfg["EVENT_COALESCE"] / DAY)
+    itr_profile = cfg["SENSORS_ITR0"] if args.itr0 >= args.itr1 else cfg["SENSORS_ITR1"]
+
+    if not sleep:
+        periodic = 0.0
+    elif cfg["EVENT_FAST_PATH"] or not itr_uplinks:
+        periodic = DAY / sleep
+    else:
+        # Full telemetry on interrupt starts a new send interval
+        p = math.exp(-itr_uplinks * sleep / DAY)
+        periodic = itr_uplinks * p / (1 - p)
+    counts["periodic"] = periodic
+
+    adaptive = cfg["CONFIRMED_DATA_UP"] == 2
+    if adaptive:
+        confirm_periodic = 1 / cfg["CONFIRM_EVERY_N"] if cfg["CONFIRM_EVERY_N"] else 0
+        confirm_itr = 1
+    else:
+        confirm_periodic = confirm_itr = 1 if cfg["CONFIRMED_DATA_UP"] == 1 else 0
+    # The backlog confirms all full telemetry uplinks, the event frames keep the mode
+    confirm_data_itr = 1 if cfg["BACKLOG"] else confirm_itr
+    if cfg["BACKLOG"]:
+        confirm_periodic = 1
+
+    pulses = (cfg["PULSE_COUNTERS"] & 1) + (cfg["PULSE_COUNTERS"] >> 1 & 1)
+    extra = (1 + 2 * pulses if pulses else 0)
+    stats = cfg["STATS_INTERVAL"]
+    covered = 0  # Point values replaced by the statistics
+    if stats:
+        stats_bme = cfg["SENSORS_PERIODIC"] & BLOCK_BME and not args.no_bme
+        stats_ds = cfg["SENSORS_PERIODIC"] & BLOCK_DS and args.ds_probes
+        stats_values = (3 if stats_bme else 0) + (1 if stats_ds else 0)
+        extra += 2 + 6 * stats_values if stats_values else 0
+        covered |= BLOCK_BME if stats_bme else 0
+        covered |= BLOCK_DS if stats_ds and (args.ds_probes == 1 or cfg["DS_ALARM"]) else 0
+
+    payload = 3 + sample_size(cfg["SENSORS_PERIODIC"] & ~covered, args.ds_probes, not args.no_bme) + extra
+    sensors(cfg["SENSORS_PERIODIC"], periodic)
+    lost = uplinks(periodic, payload, confirm_periodic)
+
+    if cfg["EVENT_FAST_PATH"]:
+        counts["event"] = itr_uplinks
+        lost += uplinks(itr_uplinks, 2 + 1 + 2, confirm_itr) if itr_uplinks else 0
+    elif itr_uplinks:
+        counts["interrupt"] = itr_uplinks
+        sensors(itr_profile, itr_uplinks)
+        payload = 3 + sample_size(itr_profile & ~covered, args.ds_probes, not args.no_bme) + extra + 1 + 2
+        lost += uplinks(itr_uplinks, payload, confirm_data_itr)
+
+    # Samples without ACK are sent later in catch-up frames
+    if cfg["BACKLOG"] and lost:
+        record = 4 + sample_size(cfg["SENSORS_PERIODIC"], min(args.ds_probes, 1), not args.no_bme)
+        per_frame = max((define(source, "BACKLOG_MAX_FRAME") - 1) // record, 1)
+        counts["catch-up"] = lost / per_frame
+        uplinks(counts["catch-up"], 1 + per_frame * record, 1)
+
+    if cfg["DIAG_INTERVAL"] and periodic:
+        counts["diag"] = periodic / cfg["DIAG_INTERVAL"]
+        uplinks(counts["diag"], 2 + 2 + 27, 0)
+
+    # Window statistics wake up between the uplinks
+    if stats and sleep:
+        wakeups = periodic * max(math.ceil(cfg["SLEEPTIME"] / stats) - 1, 0)
+        awake(wakeups * timing["stats_wake_ms"])
+        sensors(cfg["SENSORS_PERIODIC"] & (BLOCK_BME | BLOCK_DS), wakeups)
+
+    awake(args.pulses * pulses * timing["pulse_wake_ms"])
+
+    # Sleep for the rest of the day
+    awake_ms = sum(charge[name] * 1000 / amps[name] for name in amps if name.startswith("PHASE_") and amps[name])
+    charge["PHASE_SLEEP"] = max(DAY * 1000 - awake_ms, 0) * amps["PHASE_SLEEP"] / 1000
+    return charge, counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Battery life projection of a LoRaProMini config")
+    parser.add_argument("config", help="config as hex string or file, as written with the config menu")
+    parser.add_argument("--itr0", type=float, default=0, metavar="N", help="interrupts per day on pin 0")
+    parser.add_argument("--itr1", type=float, default=0, metavar="N", help="interrupts per day on pin 1")
+    parser.add_argument("--pulses", type=float, default=0, metavar="N", help="pulses per day on each pulse counter")
+    parser.add_argument("--sf", type=int, default=7, choices=range(7, 13), help="spreading factor (default 7)")
+    parser.add_argument("--ack-loss", type=float, default=0, metavar="P", help="probability of a missing ACK per attempt")
+    parser.add_argument("--ds-probes", type=int, default=1, metavar="N", help="DS18x probes on the bus (default 1)")
+    parser.add_argument("--no-bme", action="store_true", help="without BME280")
+    parser.add_argument("--tx-ms", type=float, help="airtime per transmission instead of the LoRa formula")
+    parser.add_argument("--diag", action="append", default=[], metavar="HEX",
+                        help="diagnostics frame (FPort 4) of the node to calibrate the timings, repeatable")
+    parser.add_argument("-c", "--chemistry", help="battery of energy_model.json (default all)")
+    parser.add_argument("--capacity", type=float, metavar="MAH", help="battery capacity instead of the chemistry's")
+    parser.add_argument("--nodes", type=int, default=1, metavar="N", help="fleet size")
+    parser.add_argument("-m", "--model", default=MODEL, help="timings and batteries (default tools/energy_model.json)")
+    args = parser.parse_args()
+
+    source = read_source()
+    with open(args.model) as f:
+        model = json.load(f)
+    cfg = read_config(args.config, config_layout(source))
+    timing = dict(model["timing"])
+    amps = currents(source, model.get("currents", {}))
+
+    if args.diag:
+        diag = read_diag(args.diag)
+        if not diag:
+            sys.exit("No cycle block in the diagnostics frames")
+        attempts = max(diag["attempts"], 1)
+        for name in ("battery", "bme", "ds", "encode"):
+            if name in diag:
+                timing[f"{name}_ms"] = diag[name]
+        timing["rx_ms"] = diag["rx"] / attempts
+        timing["wake_ms"] = max(diag["awake"] - diag["tx"] - diag["rx"], 0)
+        args.tx_ms = args.tx_ms or diag["tx"] / attempts
+        print(f"Calibrated from {len(args.diag)} diagnostics frames, the node estimated "
+              f"{diag['charge'] / 1000:.2f} mC per cycle")
+
+    if not cfg["CONFIG_IS_VALID"]:
+        print("WARNING config is not marked valid")
+    if (args.itr0 or args.itr1) and not cfg["WAKEUP_BY_INTERRUPT_PINS"]:
+        print("WARNING interrupts are disabled in the config, --itr0/--itr1 are ignored")
+
+    charge, counts = project(cfg, args, timing, amps, source)
+    total = sum(charge.values())
+    mah = total / 3600 / 1000
+
+    print(f"SLEEPTIME {cfg['SLEEPTIME']} s, SF{args.sf}, "
+          f"{['unconfirmed', 'confirmed', 'adaptive'][min(cfg['CONFIRMED_DATA_UP'], 2)]}"
+          f"{' (telemetry confirmed by backlog)' if cfg['BACKLOG'] else ''}, "
+          f"{args.itr0 + args.itr1:g} interrupts/day")
+    print("Uplinks per day: " + ", ".join(f"{name} {value:.1f}" for name, value in counts.items()))
+    print(f"  {'Phase':<14} {'µA':>6} {'mAh/day':>9} {'share':>6}")
+    for name, value in sorted(charge.items(), key=lambda c: -c[1]):
+        print(f"  {name:<14} {amps[name]:6d} {value / 3.6e6:9.4f} {value * 100 / total if total else 0:5.1f}%")
+    print(f"  {'Total':<14} {'':6} {mah:9.4f}   mean {mah * 1000 / 24:.1f} µA")
+    print()
+
+    chemistries = model["chemistries"]
+    if args.chemistry:
+        if args.chemistry not in chemistries:
+            sys.exit(f"Unknown chemistry {args.chemistry}, one of {', '.join(chemistries)}")
+        chemistries = {args.chemistry: chemistries[args.chemistry]}
+    for key, battery in chemistries.items():
+        capacity = args.capacity or battery["capacity_mah"]
+        usable = capacity * battery["usable"]
+        days = usable / (mah + capacity * battery["self_discharge"] / 365)
+        line = f"{battery['name']:<24} {capacity:6.0f} mAh  {days / 365:5.1f} years"
+        if args.nodes > 1:
+            line += f"  {args.nodes * 365 / days:8.0f} batteries/year"
+        print(line)
+    if args.nodes > 1:
+        print(f"Fleet of {args.nodes} nodes: {args.nodes * mah / 1000:.2f} Ah/day")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
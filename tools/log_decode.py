@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Decoder of the tokenized debug log (LOG_TOKENS, debug env).
+#
+# Turns the binary records of the serial output back into text with the event
+# table in include/logevents.h. Use the table of the firmware that was flashed.
+# Bytes outside of records are passed through, so text output can be mixed in.
+#
+#   python tools/log_decode.py COM3                 # serial port (needs pyserial)
+#   python tools/log_decode.py capture.bin          # file
+#   .pio/build/native/program | python tools/log_decode.py -
+
+import argparse
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+EVENTS = os.path.join(ROOT, "include", "logevents.h")
+LOG_SYNC = 0xA5
+
+
+def read_events(path):
+    """Texts of the events, in the order of their index"""
+    with open(path) as f:
+        source = f.read()
+    events = []
+    for match in re.finditer(r'^LOG_EVENT\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', source, re.MULTILINE):
+        events.append(match.group(2).encode().decode("unicode_escape"))
+    return events
+
+
+def byte_stream(source, baud):
+    if source == "-":
+        stream = sys.stdin.buffer
+    elif os.path.exists(source) and not source.startswith("/dev/"):
+        stream = open(source, "rb")
+    else:
+        import serial  # pyserial
+
+        stream = serial.Serial(source, baud)
+    while True:
+        data = stream.read(1)
+        if not data:
+            return
+        yield data[0]
+
+
+def varint(stream):
+    value = 0
+    shift = 0
+    for byte in stream:
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value
+    raise EOFError
+
+
+def decode_record(events, index, stream):
+    """Text of the record of event index, the arguments are read from the stream"""
+    parts = re.split(r"%([udxh])", events[index])
+    text = parts[0]
+    for i in range(1, len(parts), 2):
+        value = varint(stream)
+        kind = parts[i]
+        if kind != "h":
+            value = (value >> 1) ^ -(value & 1)  # Zigzag
+        if kind in "ux":
+            value &= 0xFFFFFFFF
+        if kind == "h":
+            value = " ".join([f"{next(stream):02X}" for _ in range(value)])
+        elif kind == "x":
+            value = f"{value:X}"
+        text += str(value) + parts[i + 1]
+    return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the tokenized debug log of LoRaProMini")
+    parser.add_argument("source", help="serial port, file or - for stdin")
+    parser.add_argument("-b", "--baud", type=int, default=9600, help="baud rate of the serial port (default 9600)")
+    parser.add_argument("-t", "--table", default=EVENTS, help="event table (default include/logevents.h)")
+    args = parser.parse_args()
+
+    events = read_events(args.table)
+    stream = byte_stream(args.source, args.baud)
+    out = sys.stdout.buffer
+
+    try:
+        for byte in stream:
+            if byte != LOG_SYNC:
+                out.write(bytes([byte]))
+                continue
+            index = next(stream)
+            if index >= len(events):
+                out.write(f"<unknown event {index}>\n".encode())
+                continue
+            out.write((decode_record(events, index, stream) + "\n").encode())
+            out.flush()
+    except (EOFError, StopIteration):
+        out.write(b"<truncated record>\n")
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
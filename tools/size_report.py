@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+# Flash/RAM footprint report of the AVR build environments.
+#
+# Builds the environments, breaks down .text/.data/.bss per component and
+# symbol, compares against the baseline in size_baseline.json and fails when
+# a budget of size_budget.json is exceeded. See README.md, "Footprint report".
+#
+#   python tools/size_report.py                    # build config, debug, release and check
+#   python tools/size_report.py -e release -s 20   # only release, 20 largest symbols
+#   python tools/size_report.py --update-baseline  # accept the current sizes
+#
+# First run: an environment without baseline is only checked against the
+# absolute budgets, then its sizes are written as baseline. Commit the file.
+# With --require-baseline (CI) a missing baseline is an error, the file is
+# still written so it can be taken from the build.
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TOOLS = os.path.join(ROOT, "tools")
+BASELINE = os.path.join(TOOLS, "size_baseline.json")
+BUDGET = os.path.join(TOOLS, "size_budget.json")
+ENVS = ["config", "debug", "release"]
+
+# Component of a symbol by its source file (needs debug info)...
+SOURCE_COMPONENTS = [
+    (r"[/\\]src[/\\]", "main"),
+    (r"TinyBME", "TinyBME"),
+    (r"TinyDallas", "TinyDallas"),
+    (r"OneWire", "OneWire"),
+    (r"LMIC|lmic", "LMIC"),
+    (r"Low-Power|LowPower", "LowPower"),
+    (r"CRC32", "CRC32"),
+    (r"libm|fp_|sf3|libgcc", "float lib"),
+    (r"framework-arduino", "Arduino core"),
+]
+
+# ...or by its name
+NAME_COMPONENTS = [
+    (r"TinyBME", "TinyBME"),
+    (r"TinyDallas", "TinyDallas"),
+    (r"OneWire", "OneWire"),
+    (r"^_?(LMIC|lmic|os_|radio_|hal_|AES|aes|lmicpins)|Arduino_LMIC|oslmic", "LMIC"),
+    (r"LowPowerClass|^LowPower", "LowPower"),
+    (r"CRC32", "CRC32"),
+    (r"^__.*[sd]f[0-9]?$|^__fp_|^(sqrt|pow|log|exp|floor|ceil|round|lround|fabs|ldexp|frexp|modf)f?$", "float lib"),
+    (r"^__|^(HardwareSerial|Print|TwoWire|SPIClass)::|^(Serial|Wire|SPI|twi_|timer0_|millis|micros|delay|pinMode|"
+     r"digital|analog|attachInterrupt|detachInterrupt|init|main|setup|loop|random|port_|digital_pin_)", "Arduino core"),
+]
+
+# nm symbol types, const data without PROGMEM is copied to RAM like .data
+SECTION_OF_TYPE = {"t": ".text", "w": ".text", "d": ".data", "r": ".data", "v": ".data", "b": ".bss"}
+
+
+def tool(name):
+    path = shutil.which(name)
+    if path:
+        return path
+    path = os.path.expanduser(os.path.join("~", ".platformio", "packages", "toolchain-atmelavr", "bin", name))
+    if os.path.exists(path):
+        return path
+    sys.exit(f"{name} not found, install the atmelavr platform of PlatformIO")
+
+
+def elf_of(env):
+    files = glob.glob(os.path.join(ROOT, ".pio", "build", env, f"firmware_*_{env}.elf"))
+    if not files:
+        sys.exit(f"No firmware image of {env}, build it first")
+    return files[0]
+
+
+def section_sizes(elf):
+    sizes = {".text": 0, ".data": 0, ".bss": 0}
+    out = subprocess.run([tool("avr-size"), "-A", elf], capture_output=True, text=True, check=True).stdout
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0] in sizes:
+            sizes[parts[0]] = int(parts[1])
+    return sizes
+
+
+def component(name, source):
+    rules = SOURCE_COMPONENTS if source else NAME_COMPONENTS
+    for pattern, comp in rules:
+        if re.search(pattern, source or name):
+            return comp
+    return "main"
+
+
+def symbols(elf):
+    """[(name, section, size, component)] of all sized symbols"""
+    out = subprocess.run([tool("avr-nm"), "-S", "-l", "-C", "--size-sort", elf],
+                         capture_output=True, text=True, check=True).stdout
+    result = []
+    for line in out.splitlines():
+        # address size type name [file:line]
+        parts = line.split(None, 3)
+        if len(parts) < 4 or parts[2].lower() not in SECTION_OF_TYPE:
+            continue
+        name, _, source = parts[3].partition("\t")
+        result.append((name, SECTION_OF_TYPE[parts[2].lower()], int(parts[1], 16), component(name, source)))
+    return result
+
+
+def report(env, top):
+    elf = elf_of(env)
+    syms = symbols(elf)
+    sizes = section_sizes(elf)
+    comps = {}
+    for name, section, size, comp in syms:
+        comps.setdefault(comp, {".text": 0, ".data": 0, ".bss": 0})[section] += size
+
+    flash = sizes[".text"] + sizes[".data"]
+    ram = sizes[".data"] + sizes[".bss"]
+    print(f"== {env}: {os.path.basename(elf)} ==")
+    print(f"Flash {flash:6d} (.text {sizes['.text']}, .data {sizes['.data']})   RAM {ram:5d} (.data {sizes['.data']}, .bss {sizes['.bss']})")
+    print(f"  {'Component':<14} {'.text':>7} {'.data':>7} {'.bss':>7}")
+    for comp, s in sorted(comps.items(), key=lambda c: -sum(c[1].values())):
+        print(f"  {comp:<14} {s['.text']:7d} {s['.data']:7d} {s['.bss']:7d}")
+    if top:
+        print("  Largest symbols:")
+        for name, section, size, comp in sorted(syms, key=lambda s: -s[2])[:top]:
+            print(f"  {size:7d} {section:<6} {comp:<14} {name}")
+        print("  Largest static RAM consumers:")
+        ram_syms = [sym for sym in syms if sym[1] != ".text"]
+        for name, section, size, comp in sorted(ram_syms, key=lambda s: -s[2])[:top]:
+            print(f"  {size:7d} {section:<6} {comp:<14} {name}")
+    print()
+
+    return {
+        "flash": flash,
+        "ram": ram,
+        "sections": sizes,
+        "components": {c: sum(s.values()) for c, s in comps.items()},
+    }
+
+
+def check(env, now, base, budget):
+    """Returns the list of exceeded budgets"""
+    errors = []
+    limits = dict(budget.get("default", {}))
+    limits.update(budget.get(env, {}))
+
+    for key in ("flash", "ram"):
+        if key in limits and now[key] > limits[key]:
+            errors.append(f"{env}: {key} {now[key]} exceeds the budget of {limits[key]}")
+
+    if not base:
+        print(f"{env}: no baseline, first run checks only the budgets")
+        return errors
+
+    growth = limits.get("growth", 0)
+    for key in ("flash", "ram"):
+        diff = now[key] - base[key]
+        if diff:
+            print(f"{env}: {key} {base[key]} -> {now[key]} ({diff:+d})")
+        if growth and diff > growth:
+            errors.append(f"{env}: {key} grew by {diff}, more than {growth}")
+    for comp in sorted(set(now["components"]) | set(base["components"])):
+        diff = now["components"].get(comp, 0) - base["components"].get(comp, 0)
+        if diff:
+            print(f"{env}:   {comp} {diff:+d}")
+    return errors
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flash/RAM footprint report of the AVR builds")
+    parser.add_argument("-e", "--env", action="append", choices=ENVS, help="environment, repeatable (default all)")
+    parser.add_argument("-s", "--symbols", type=int, default=10, metavar="N", help="show the N largest symbols")
+    parser.add_argument("--no-build", action="store_true", help="use the existing firmware images")
+    parser.add_argument("--update-baseline", action="store_true", help="write the current sizes as baseline")
+    parser.add_argument("--require-baseline", action="store_true", help="fail if an environment has no baseline")
+    args = parser.parse_args()
+    envs = args.env or ENVS
+
+    if not args.no_build:
+        cmd = ["pio", "run", "-d", ROOT]
+        for env in envs:
+            cmd += ["-e", env]
+        subprocess.run(cmd, check=True)
+
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+    with open(BUDGET) as f:
+        budget = json.load(f)
+
+    errors = []
+    first = []  # Environments without baseline
+    for env in envs:
+        now = report(env, args.symbols)
+        if args.update_baseline:
+            baseline[env] = now
+            continue
+        errors += check(env, now, baseline.get(env), budget)
+        if env not in baseline:
+            first.append(env)
+            baseline[env] = now
+
+    # The first run of an environment writes its baseline, if it is within the budgets
+    if args.update_baseline or (first and not errors):
+        with open(BASELINE, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        note = f" for {', '.join(first)}, commit it" if first else ""
+        print(f"Baseline written to {os.path.relpath(BASELINE, ROOT)}{note}")
+    if args.update_baseline:
+        return 0
+
+    if args.require_baseline:
+        errors += [f"{env}: no baseline in {os.path.relpath(BASELINE, ROOT)}" for env in first]
+    for error in errors:
+        print(f"ERROR {error}")
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())